@@ -0,0 +1,599 @@
+// Stage-level benchmark: decode, resample, render (quantize and serialize
+// escapes) and write, each timed on its own over several runs, on the
+// bundled images and on generated flat, gradient and noise images.
+//
+// Run from the repository root; see "Benchmarks" in README.md.
+
+#include "input.h"
+#include "jpeg_handler.h"
+#include "kernels.h"
+#include "png_handler.h"
+#include "pool.h"
+#include "render.h"
+#include "resample.h"
+#include "timing.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_RUNS 1000
+
+typedef enum {
+    STAGE_DECODE,
+    STAGE_RESAMPLE,
+    STAGE_RENDER,
+    STAGE_WRITE,
+    STAGE_COUNT,
+} Stage;
+
+static const char *const stage_names[STAGE_COUNT] = {"decode", "resample", "render", "write"};
+
+// Output modes: one resampling kernel (with the decoder settings of its
+// --quality preset) times one way of encoding cells
+typedef struct {
+    const char *name;
+    ResampleKernel kernel;
+    Quality quality;
+} KernelMode;
+
+static const KernelMode kernel_modes[] = {
+    {"nearest", RESAMPLE_NEAREST, QUALITY_FAST},
+    {"box", RESAMPLE_BOX, QUALITY_BALANCED},
+    {"lanczos", RESAMPLE_LANCZOS, QUALITY_BEST},
+};
+
+typedef struct {
+    const char *name;
+    ColorDepth colors;
+    Dither dither;
+    int sparse;
+} EncoderMode;
+
+static const EncoderMode encoder_modes[] = {
+    {"truecolor", COLOR_TRUECOLOR, DITHER_NONE, 0},
+    {"256", COLOR_256, DITHER_NONE, 0},
+    {"256-dither", COLOR_256, DITHER_ORDERED, 0},
+    {"truecolor-sparse", COLOR_TRUECOLOR, DITHER_NONE, 1},
+};
+
+#define KERNEL_MODES (int)(sizeof(kernel_modes) / sizeof(kernel_modes[0]))
+#define ENCODER_MODES (int)(sizeof(encoder_modes) / sizeof(encoder_modes[0]))
+
+typedef enum {
+    SYNTHETIC_FLAT,
+    SYNTHETIC_GRADIENT,
+    SYNTHETIC_NOISE,
+} Synthetic;
+
+static const char *const synthetic_names[] = {"flat", "gradient", "noise"};
+
+typedef struct {
+    int runs;
+    int columns;
+    int cell_width; // Cell shape in pixels; 0 = 1:2
+    int cell_height;
+    int max_megapixels;
+    int write_fd;
+} BenchOptions;
+
+// Sample times of one stage, in milliseconds
+typedef struct {
+    double ms[MAX_RUNS];
+    int count;
+} Samples;
+
+// -------------------------------------------------------------
+// Helper: Statistics over the runs of one stage
+// -------------------------------------------------------------
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const Samples *s, double p)
+{
+    int rank = (int)(p / 100.0 * s->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return s->ms[rank - 1];
+}
+
+// -------------------------------------------------------------
+// Frames: whole images held in memory between stages
+// -------------------------------------------------------------
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    unsigned char *pixels;
+    int rows_in; // Rows received so far
+} Frame;
+
+static int frame_alloc(Frame *frame, int width, int height, int channels)
+{
+    frame->width = width;
+    frame->height = height;
+    frame->channels = channels;
+    frame->rows_in = 0;
+    frame->pixels = pool_alloc((size_t)width * height * channels);
+    return frame->pixels == NULL;
+}
+
+static void frame_free(Frame *frame)
+{
+    pool_free(frame->pixels);
+    frame->pixels = NULL;
+}
+
+// Output grid for a source size, planned as vishellize plans it
+static void plan_grid(const BenchOptions *bench, int width, int height, int *columns, int *rows)
+{
+    RenderOptions options = {.width = bench->columns, .cell_width = bench->cell_width, .cell_height = bench->cell_height};
+    render_plan(&options, width, height, columns, rows);
+}
+
+// -------------------------------------------------------------
+// Decode stage: a sink that only keeps the rows
+// -------------------------------------------------------------
+typedef struct {
+    Frame frame;
+    const BenchOptions *bench;
+    int failed;
+} CaptureSink;
+
+static void capture_plan(void *user, int width, int height, int *out_width, int *out_height)
+{
+    CaptureSink *capture = user;
+    plan_grid(capture->bench, width, height, out_width, out_height);
+}
+
+static int capture_begin(void *user, int width, int height, int channels)
+{
+    CaptureSink *capture = user;
+    frame_free(&capture->frame);
+    if (frame_alloc(&capture->frame, width, height, channels))
+    {
+        fprintf(stderr, "Couldn't allocate memory for a %dx%d frame.\n", width, height);
+        return 1;
+    }
+    return 0;
+}
+
+static void capture_row(void *user, const unsigned char *pixels)
+{
+    Frame *frame = &((CaptureSink *)user)->frame;
+    if (frame->rows_in < frame->height)
+    {
+        size_t bytes = (size_t)frame->width * frame->channels;
+        memcpy(frame->pixels + frame->rows_in++ * bytes, pixels, bytes);
+    }
+}
+
+static int decode_file(const InputBuffer *input, Quality quality, const BenchOptions *bench, Frame *frame)
+{
+    CaptureSink capture = {.bench = bench};
+    RowSink sink = {capture_plan, capture_begin, NULL, NULL, capture_row, &capture};
+    DecodeOptions decode = {.quality = quality};
+
+    ImageFormat format = detect_format(input->data, input->size);
+    int failed = format == FORMAT_PNG    ? decode_png(input->data, input->size, &decode, &sink)
+                 : format == FORMAT_JPEG ? decode_jpeg(input->data, input->size, &decode, &sink)
+                                         : 1;
+    if (failed || capture.frame.rows_in != capture.frame.height)
+    {
+        frame_free(&capture.frame);
+        return 1;
+    }
+    *frame = capture.frame;
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Synthetic sources, generated a row at a time
+// -------------------------------------------------------------
+static void synthetic_row(Synthetic kind, int width, int height, int y, unsigned char *row, uint32_t *seed)
+{
+    for (int x = 0; x < width; x++)
+    {
+        unsigned char *px = row + x * 3;
+        switch (kind)
+        {
+        case SYNTHETIC_FLAT:
+            px[0] = 40, px[1] = 90, px[2] = 160;
+            break;
+        case SYNTHETIC_GRADIENT:
+            px[0] = (unsigned char)((long long)x * 255 / width);
+            px[1] = (unsigned char)((long long)y * 255 / height);
+            px[2] = (unsigned char)(255 - px[0]);
+            break;
+        case SYNTHETIC_NOISE:
+            // xorshift32
+            *seed ^= *seed << 13;
+            *seed ^= *seed >> 17;
+            *seed ^= *seed << 5;
+            memcpy(px, seed, 3);
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Resample stage
+// -------------------------------------------------------------
+static void store_row(void *user, const unsigned char *row, int width, int channels)
+{
+    Frame *frame = user;
+    size_t bytes = (size_t)width * channels;
+    memcpy(frame->pixels + frame->rows_in++ * bytes, row, bytes);
+}
+
+// Source rows come from a decoded frame, or are generated on the fly
+// with only the pushes timed
+static double resample_frame(const Frame *source, Synthetic kind, int width, int height, ResampleKernel kernel,
+                             Frame *out)
+{
+    int channels = source ? source->channels : 3;
+    Resampler rs;
+    if (resampler_init(&rs, kernel, width, height, out->width, out->height, channels, 8, 0, store_row, out))
+        return -1;
+    if (channels == 4)
+    {
+        static const unsigned char black[3] = {0, 0, 0};
+        resampler_set_background(&rs, black);
+    }
+    out->rows_in = 0;
+
+    double elapsed = 0;
+    if (source)
+    {
+        double start = monotonic_ms();
+        size_t bytes = (size_t)width * channels;
+        for (int y = 0; y < height; y++)
+            resampler_push_row(&rs, source->pixels + y * bytes);
+        elapsed = monotonic_ms() - start;
+    }
+    else
+    {
+        unsigned char *row = pool_alloc((size_t)width * 3);
+        uint32_t seed = 2463534242u;
+        for (int y = 0; row && y < height; y++)
+        {
+            synthetic_row(kind, width, height, y, row, &seed);
+            double start = monotonic_ms();
+            resampler_push_row(&rs, row);
+            elapsed += monotonic_ms() - start;
+        }
+        if (row == NULL)
+            elapsed = -1;
+        pool_free(row);
+    }
+
+    resampler_free(&rs);
+    return elapsed;
+}
+
+// -------------------------------------------------------------
+// Render and write stages
+// -------------------------------------------------------------
+static double render_frame(const Frame *grid, const EncoderMode *mode, char **text, size_t *length)
+{
+    FILE *out = open_memstream(text, length);
+    if (out == NULL)
+        return -1;
+
+    RenderOptions options = {.colors = mode->colors, .dither = mode->dither, .sparse = mode->sparse, .tolerance = 3};
+    RenderOutput output = {.file = out};
+    Renderer renderer;
+    if (renderer_init(&renderer, &output, grid->width, &options))
+    {
+        fclose(out);
+        return -1;
+    }
+
+    double start = monotonic_ms();
+    size_t bytes = (size_t)grid->width * grid->channels;
+    for (int y = 0; y < grid->height; y++)
+        render_row(&renderer, grid->pixels + y * bytes, grid->width, grid->channels);
+    fflush(out);
+    double elapsed = monotonic_ms() - start;
+
+    renderer_free(&renderer);
+    fclose(out);
+    return elapsed;
+}
+
+static double write_text(int fd, const char *text, size_t length)
+{
+    double start = monotonic_ms();
+    while (length > 0)
+    {
+        ssize_t written = write(fd, text, length);
+        if (written <= 0)
+            return -1;
+        text += written;
+        length -= (size_t)written;
+    }
+    return monotonic_ms() - start;
+}
+
+// -------------------------------------------------------------
+// Reporting: a table on stdout, one JSON object per result
+// -------------------------------------------------------------
+static void report(FILE *json, int *first, const char *image, int width, int height, const char *kernel,
+                   const char *encoder, size_t bytes, Samples *stages)
+{
+    printf("%-22s %-8s %-17s %10zu", image, kernel, encoder, bytes);
+    if (json)
+    {
+        fprintf(json,
+                "%s\n    {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"kernel\": \"%s\", "
+                "\"encoder\": \"%s\", \"bytes\": %zu",
+                *first ? "" : ",", image, width, height, kernel, encoder, bytes);
+        *first = 0;
+    }
+
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        Samples *samples = &stages[s];
+        if (samples->count == 0)
+        {
+            printf("  %24s", "-");
+            continue;
+        }
+        qsort(samples->ms, samples->count, sizeof(double), compare_ms);
+        double min = samples->ms[0], median = percentile(samples, 50), p99 = percentile(samples, 99);
+        printf("  %7.2f %7.2f %8.2f", min, median, p99);
+        if (json)
+            fprintf(json, ", \"%s\": {\"min_ms\": %.3f, \"median_ms\": %.3f, \"p99_ms\": %.3f}", stage_names[s], min,
+                    median, p99);
+    }
+    printf("\n");
+    if (json)
+        fprintf(json, "}");
+}
+
+static void print_header(void)
+{
+    printf("%-22s %-8s %-17s %10s", "image", "kernel", "encoder", "bytes");
+    for (int s = 0; s < STAGE_COUNT; s++)
+        printf("  %-24s", stage_names[s]);
+    printf("\n%-60s", "");
+    for (int s = 0; s < STAGE_COUNT; s++)
+        printf("  %7s %7s %8s", "min", "median", "p99");
+    printf("\n");
+}
+
+// -------------------------------------------------------------
+// One source through every mode. Decoded sources are decoded once
+// per kernel mode, since the presets change the decoder settings.
+// -------------------------------------------------------------
+static int bench_source(const char *name, const InputBuffer *input, Synthetic kind, int width, int height,
+                        const BenchOptions *bench, FILE *json, int *first)
+{
+    for (int k = 0; k < KERNEL_MODES; k++)
+    {
+        const KernelMode *kernel = &kernel_modes[k];
+        Samples stages[STAGE_COUNT];
+        memset(stages, 0, sizeof(stages));
+
+        Frame source = {0};
+        if (input)
+        {
+            for (int run = 0; run < bench->runs; run++)
+            {
+                frame_free(&source);
+                double start = monotonic_ms();
+                if (decode_file(input, kernel->quality, bench, &source))
+                {
+                    fprintf(stderr, "Couldn't decode %s.\n", name);
+                    return 1;
+                }
+                stages[STAGE_DECODE].ms[stages[STAGE_DECODE].count++] = monotonic_ms() - start;
+            }
+            width = source.width;
+            height = source.height;
+        }
+
+        int columns, rows;
+        plan_grid(bench, width, height, &columns, &rows);
+        Frame grid;
+        if (frame_alloc(&grid, columns, rows, input ? source.channels : 3))
+        {
+            frame_free(&source);
+            return 1;
+        }
+
+        for (int run = 0; run < bench->runs; run++)
+        {
+            double ms = resample_frame(input ? &source : NULL, kind, width, height, kernel->kernel, &grid);
+            if (ms < 0)
+            {
+                fprintf(stderr, "Couldn't resample %s.\n", name);
+                frame_free(&grid);
+                frame_free(&source);
+                return 1;
+            }
+            stages[STAGE_RESAMPLE].ms[stages[STAGE_RESAMPLE].count++] = ms;
+        }
+        frame_free(&source);
+
+        for (int e = 0; e < ENCODER_MODES; e++)
+        {
+            Samples encoded[STAGE_COUNT];
+            memcpy(encoded, stages, sizeof(encoded));
+            encoded[STAGE_RENDER].count = encoded[STAGE_WRITE].count = 0;
+
+            size_t bytes = 0;
+            for (int run = 0; run < bench->runs; run++)
+            {
+                char *text = NULL;
+                size_t length = 0;
+                double render_ms = render_frame(&grid, &encoder_modes[e], &text, &length);
+                double write_ms = render_ms < 0 ? -1 : write_text(bench->write_fd, text, length);
+                free(text);
+                if (write_ms < 0)
+                {
+                    fprintf(stderr, "Couldn't render or write %s.\n", name);
+                    frame_free(&grid);
+                    return 1;
+                }
+                encoded[STAGE_RENDER].ms[encoded[STAGE_RENDER].count++] = render_ms;
+                encoded[STAGE_WRITE].ms[encoded[STAGE_WRITE].count++] = write_ms;
+                bytes = length;
+            }
+            report(json, first, name, width, height, kernel->name, encoder_modes[e].name, bytes, encoded);
+        }
+        frame_free(&grid);
+    }
+    return 0;
+}
+
+static void print_help(void)
+{
+    printf("Usage:\n"
+           "  vishellize-bench [--runs <n>] [--width <columns>] [--cell-size <w>x<h>] [--max-mp <megapixels>]\n"
+           "                   [--json <file>] [--out <file>] [--cpu <variant>] [image] [...]\n"
+           "Times each stage on the given images (default: Lenna.jpg, Lenna.png, sample.png)\n"
+           "and on synthetic flat, gradient and noise images of 1, 10 and 100 megapixels.\n"
+           "Grids are planned as vishellize plans them, with 1:2 cells unless --cell-size is given.\n"
+           "Rendered text is written to /dev/null unless --out is given.\n");
+}
+
+// -------------------------------------------------------------
+// MAIN FUNCTION
+// -------------------------------------------------------------
+int main(int argc, char const *argv[])
+{
+    BenchOptions bench = {.runs = 7, .columns = 200, .max_megapixels = 100};
+    const char *json_path = NULL;
+    const char *out_path = "/dev/null";
+    const char *images[64];
+    int image_count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+        {
+            print_help();
+            return EXIT_SUCCESS;
+        }
+        if (value && strcmp(arg, "--runs") == 0)
+            bench.runs = atoi(argv[++i]);
+        else if (value && strcmp(arg, "--width") == 0)
+            bench.columns = atoi(argv[++i]);
+        else if (value && strcmp(arg, "--cell-size") == 0)
+        {
+            char trailing;
+            if (sscanf(argv[++i], "%dx%d%c", &bench.cell_width, &bench.cell_height, &trailing) != 2 ||
+                bench.cell_width <= 0 || bench.cell_height <= 0)
+            {
+                fprintf(stderr, "Flag '%s' expects a cell size in pixels like 8x16.\n", arg);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (value && strcmp(arg, "--max-mp") == 0)
+            bench.max_megapixels = atoi(argv[++i]);
+        else if (value && strcmp(arg, "--cpu") == 0)
+        {
+            if (pixel_kernels_select(argv[++i]))
+            {
+                fprintf(stderr, "This CPU or build has no '%s' kernels.\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (value && strcmp(arg, "--json") == 0)
+            json_path = argv[++i];
+        else if (value && strcmp(arg, "--out") == 0)
+            out_path = argv[++i];
+        else if (arg[0] != '-' && image_count < 64)
+            images[image_count++] = arg;
+        else
+        {
+            fprintf(stderr, "Invalid flag '%s'.\n", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (bench.runs < 1 || bench.runs > MAX_RUNS || bench.columns < 1 || bench.max_megapixels < 0)
+    {
+        fprintf(stderr, "Runs must be 1 to %d; width and megapixels positive.\n", MAX_RUNS);
+        return EXIT_FAILURE;
+    }
+
+    if (image_count == 0)
+    {
+        images[image_count++] = "Lenna.jpg";
+        images[image_count++] = "Lenna.png";
+        images[image_count++] = "sample.png";
+    }
+
+    bench.write_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (bench.write_fd < 0)
+    {
+        fprintf(stderr, "Couldn't open '%s' for writing.\n", out_path);
+        return EXIT_FAILURE;
+    }
+
+    FILE *json = NULL;
+    if (json_path && (json = fopen(json_path, "w")) == NULL)
+    {
+        fprintf(stderr, "Couldn't open '%s' for writing.\n", json_path);
+        return EXIT_FAILURE;
+    }
+    if (json)
+        fprintf(json, "{\"runs\": %d, \"columns\": %d, \"cpu\": \"%s\", \"results\": [", bench.runs, bench.columns,
+                pixel_kernels()->name);
+
+    printf("Pixel kernels: %s\n", pixel_kernels()->name);
+    print_header();
+    int first = 1;
+    int status = EXIT_SUCCESS;
+
+    for (int i = 0; i < image_count && status == EXIT_SUCCESS; i++)
+    {
+        FILE *file = fopen(images[i], "rb");
+        InputBuffer input;
+        if (file == NULL || input_open(file, &input) || (!input.complete && input_read_rest(file, &input)))
+        {
+            fprintf(stderr, "Couldn't open file '%s'.\n", images[i]);
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (bench_source(images[i], &input, SYNTHETIC_FLAT, 0, 0, &bench, json, &first))
+            status = EXIT_FAILURE;
+        input_release(&input);
+        fclose(file);
+    }
+
+    // Square synthetic images of 1, 10 and 100 megapixels
+    static const int megapixels[] = {1, 10, 100};
+    for (int m = 0; m < 3 && status == EXIT_SUCCESS; m++)
+    {
+        if (megapixels[m] > bench.max_megapixels)
+            break;
+        int side = megapixels[m] == 1 ? 1000 : megapixels[m] == 10 ? 3162 : 10000;
+        for (int kind = SYNTHETIC_FLAT; kind <= SYNTHETIC_NOISE && status == EXIT_SUCCESS; kind++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%s-%dmp", synthetic_names[kind], megapixels[m]);
+            if (bench_source(name, NULL, (Synthetic)kind, side, side, &bench, json, &first))
+                status = EXIT_FAILURE;
+        }
+    }
+
+    if (json)
+    {
+        fprintf(json, "\n]}\n");
+        fclose(json);
+    }
+    close(bench.write_fd);
+    pool_trim();
+    return status;
+}
@@ -0,0 +1,525 @@
+// Terminal-throughput benchmark: renders each image once per encoder
+// mode, then times pushing the text through a local pseudo-terminal to a
+// reader process on the other side, which can also interpret it with a
+// small VT state machine the way a terminal would. What matters on a
+// real terminal is how fast the whole path drains, not how fast we render.
+//
+// Run from the repository root; see "Benchmarks" in README.md.
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include "input.h"
+#include "jpeg_handler.h"
+#include "png_handler.h"
+#include "pool.h"
+#include "render.h"
+#include "timing.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define MAX_RUNS 1000
+
+typedef struct {
+    const char *name;
+    ColorDepth colors;
+    Dither dither;
+    int sparse;
+} EncoderMode;
+
+static const EncoderMode encoder_modes[] = {
+    {"truecolor", COLOR_TRUECOLOR, DITHER_NONE, 0},
+    {"256", COLOR_256, DITHER_NONE, 0},
+    {"256-dither", COLOR_256, DITHER_ORDERED, 0},
+    {"truecolor-sparse", COLOR_TRUECOLOR, DITHER_NONE, 1},
+};
+
+#define ENCODER_MODES (int)(sizeof(encoder_modes) / sizeof(encoder_modes[0]))
+
+// What the reader saw in one run, sent back to the writer over a pipe
+typedef struct {
+    size_t bytes;
+    size_t glyphs;    // Characters put on the screen
+    size_t sequences; // Escape sequences of any kind
+    size_t sgr;       // Of which SGR (color) sequences
+    uint32_t checksum;
+} ReaderResult;
+
+// -------------------------------------------------------------
+// Minimal VT parser: enough of a terminal to do the work ours does per
+// byte. It tracks the cursor, SGR colors and UTF-8 glyphs on a screen.
+// -------------------------------------------------------------
+typedef enum {
+    VT_GROUND,
+    VT_ESCAPE,
+    VT_CSI,
+    VT_OSC,
+} VtState;
+
+#define VT_MAX_PARAMS 16
+
+typedef struct {
+    uint32_t glyph;
+    uint32_t fg; // 0xRRGGBB, or 1 << 24 | index for 256 colors
+    uint32_t bg;
+} VtCell;
+
+typedef struct {
+    VtState state;
+    int params[VT_MAX_PARAMS];
+    int param_count;
+    uint32_t codepoint;
+    int continuation; // UTF-8 bytes still expected
+    int x, y;
+    uint32_t fg, bg;
+    int columns, rows;
+    VtCell *screen;
+    ReaderResult result;
+} Vt;
+
+static void vt_apply_sgr(Vt *vt)
+{
+    if (vt->param_count == 0)
+        vt->fg = vt->bg = 0;
+
+    for (int i = 0; i < vt->param_count; i++)
+    {
+        int p = vt->params[i];
+        uint32_t *target = p == 38 ? &vt->fg : p == 48 ? &vt->bg : NULL;
+        if (p == 0)
+            vt->fg = vt->bg = 0;
+        else if (p == 39)
+            vt->fg = 0;
+        else if (p == 49)
+            vt->bg = 0;
+        else if (target && i + 2 < vt->param_count && vt->params[i + 1] == 5)
+        {
+            *target = 1u << 24 | (uint32_t)vt->params[i + 2];
+            i += 2;
+        }
+        else if (target && i + 4 < vt->param_count && vt->params[i + 1] == 2)
+        {
+            *target = (uint32_t)vt->params[i + 2] << 16 | (uint32_t)vt->params[i + 3] << 8 | (uint32_t)vt->params[i + 4];
+            i += 4;
+        }
+    }
+}
+
+static void vt_clamp(Vt *vt)
+{
+    if (vt->x < 0)
+        vt->x = 0;
+    if (vt->x >= vt->columns)
+        vt->x = vt->columns - 1;
+    if (vt->y < 0)
+        vt->y = 0;
+    if (vt->y >= vt->rows)
+        vt->y = vt->rows - 1;
+}
+
+static void vt_put(Vt *vt, uint32_t glyph)
+{
+    VtCell *cell = &vt->screen[vt->y * vt->columns + vt->x];
+    cell->glyph = glyph;
+    cell->fg = vt->fg;
+    cell->bg = vt->bg;
+    vt->result.glyphs++;
+    if (vt->x < vt->columns - 1)
+        vt->x++;
+}
+
+static void vt_csi(Vt *vt, unsigned char final)
+{
+    int n = vt->param_count > 0 && vt->params[0] > 0 ? vt->params[0] : 1;
+    vt->result.sequences++;
+    switch (final)
+    {
+    case 'm':
+        vt->result.sgr++;
+        vt_apply_sgr(vt);
+        break;
+    case 'A':
+        vt->y -= n;
+        break;
+    case 'B':
+        vt->y += n;
+        break;
+    case 'C':
+        vt->x += n;
+        break;
+    case 'D':
+        vt->x -= n;
+        break;
+    case 'G':
+        vt->x = n - 1;
+        break;
+    }
+    vt_clamp(vt);
+}
+
+static void vt_feed(Vt *vt, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char c = data[i];
+        switch (vt->state)
+        {
+        case VT_GROUND:
+            if (c == 0x1b)
+                vt->state = VT_ESCAPE;
+            else if (c == '\r')
+                vt->x = 0;
+            else if (c == '\n')
+            {
+                // The tty would have added the carriage return (ONLCR)
+                vt->x = 0;
+                if (vt->y < vt->rows - 1)
+                    vt->y++;
+            }
+            else if (c >= 0xc0)
+            {
+                vt->continuation = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+                vt->codepoint = c & (0x3f >> vt->continuation);
+            }
+            else if (c >= 0x80)
+            {
+                vt->codepoint = vt->codepoint << 6 | (c & 0x3f);
+                if (vt->continuation > 0 && --vt->continuation == 0)
+                    vt_put(vt, vt->codepoint);
+            }
+            else if (c >= 0x20)
+                vt_put(vt, c);
+            break;
+        case VT_ESCAPE:
+            vt->param_count = 0;
+            vt->params[0] = 0;
+            if (c == '[')
+                vt->state = VT_CSI;
+            else if (c == ']')
+                vt->state = VT_OSC;
+            else
+            {
+                vt->result.sequences++;
+                vt->state = VT_GROUND;
+            }
+            break;
+        case VT_CSI:
+            if (c >= '0' && c <= '9')
+            {
+                if (vt->param_count == 0)
+                    vt->param_count = 1;
+                int *p = &vt->params[vt->param_count - 1];
+                *p = *p * 10 + (c - '0');
+            }
+            else if (c == ';')
+            {
+                if (vt->param_count == 0)
+                    vt->param_count = 1;
+                if (vt->param_count < VT_MAX_PARAMS)
+                    vt->params[vt->param_count++] = 0;
+            }
+            else if (c >= 0x40 && c <= 0x7e)
+            {
+                vt_csi(vt, c);
+                vt->state = VT_GROUND;
+            }
+            break;
+        case VT_OSC:
+            // Ends with BEL, or with ESC \, which the escape state counts
+            if (c == 0x07)
+            {
+                vt->result.sequences++;
+                vt->state = VT_GROUND;
+            }
+            else if (c == 0x1b)
+                vt->state = VT_ESCAPE;
+            break;
+        }
+    }
+}
+
+static uint32_t vt_checksum(const Vt *vt)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < vt->columns * vt->rows; i++)
+    {
+        const VtCell *cell = &vt->screen[i];
+        hash = (hash ^ cell->glyph) * 16777619u;
+        hash = (hash ^ cell->fg) * 16777619u;
+        hash = (hash ^ cell->bg) * 16777619u;
+    }
+    return hash;
+}
+
+// -------------------------------------------------------------
+// Reader process: the terminal's side of the pty. Each run it drains
+// exactly the number of bytes written and reports back.
+// -------------------------------------------------------------
+static void run_reader(int master, int report, size_t length, int runs, int parse, int columns, int rows)
+{
+    static unsigned char buffer[64 * 1024];
+    Vt vt = {.columns = columns, .rows = rows};
+    if (parse && (vt.screen = calloc((size_t)columns * rows, sizeof(VtCell))) == NULL)
+        _exit(1);
+
+    for (int run = 0; run < runs; run++)
+    {
+        vt.state = VT_GROUND;
+        vt.x = vt.y = 0;
+        vt.fg = vt.bg = 0;
+        memset(&vt.result, 0, sizeof(vt.result));
+
+        while (vt.result.bytes < length)
+        {
+            ssize_t got = read(master, buffer, sizeof(buffer));
+            if (got <= 0)
+                _exit(1);
+            vt.result.bytes += (size_t)got;
+            if (parse)
+                vt_feed(&vt, buffer, (size_t)got);
+        }
+
+        if (parse)
+            vt.result.checksum = vt_checksum(&vt);
+        if (write(report, &vt.result, sizeof(vt.result)) != sizeof(vt.result))
+            _exit(1);
+    }
+    _exit(0);
+}
+
+// -------------------------------------------------------------
+// Helper: A pty pair with the line discipline in raw mode, so the
+// reader gets exactly the bytes written (no \n to \r\n translation)
+// -------------------------------------------------------------
+static int open_pty(int *master, int *slave)
+{
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) || unlockpt(*master))
+        return 1;
+
+    char *name = ptsname(*master);
+    *slave = name ? open(name, O_RDWR | O_NOCTTY) : -1;
+    if (*slave < 0)
+    {
+        close(*master);
+        return 1;
+    }
+
+    struct termios termios;
+    if (tcgetattr(*slave, &termios) == 0)
+    {
+        cfmakeraw(&termios);
+        tcsetattr(*slave, TCSANOW, &termios);
+    }
+    return 0;
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// -------------------------------------------------------------
+// One rendered text through the pty, runs times
+// -------------------------------------------------------------
+static int drain_through_pty(const char *text, size_t length, int runs, int parse, int columns, int rows,
+                             double *ms, ReaderResult *result)
+{
+    int master, slave, report[2];
+    if (open_pty(&master, &slave))
+    {
+        fprintf(stderr, "Couldn't open a pseudo-terminal.\n");
+        return 1;
+    }
+    if (pipe(report))
+    {
+        close(master);
+        close(slave);
+        return 1;
+    }
+
+    pid_t reader = fork();
+    if (reader < 0)
+        return 1;
+    if (reader == 0)
+    {
+        close(slave);
+        close(report[0]);
+        run_reader(master, report[1], length, runs, parse, columns, rows);
+    }
+    close(master);
+    close(report[1]);
+
+    int failed = 0;
+    for (int run = 0; run < runs && !failed; run++)
+    {
+        double start = monotonic_ms();
+        const char *p = text;
+        size_t left = length;
+        while (left > 0)
+        {
+            ssize_t written = write(slave, p, left);
+            if (written <= 0)
+                break;
+            p += written;
+            left -= (size_t)written;
+        }
+        // The run ends when the reader has taken in the last byte
+        failed = left > 0 || read(report[0], result, sizeof(*result)) != sizeof(*result);
+        ms[run] = monotonic_ms() - start;
+    }
+
+    close(slave);
+    close(report[0]);
+    int status;
+    waitpid(reader, &status, 0);
+    if (failed)
+        fprintf(stderr, "Couldn't push the output through the pseudo-terminal.\n");
+    return failed;
+}
+
+// -------------------------------------------------------------
+// Helper: Render a file into memory the way the tool would
+// -------------------------------------------------------------
+static int render_to_memory(const InputBuffer *input, const RenderOptions *options, char **text, size_t *length,
+                            int *columns, int *rows)
+{
+    FILE *out = open_memstream(text, length);
+    if (out == NULL)
+        return 1;
+
+    RenderOutput output = {.file = out};
+    RenderPipeline pipeline;
+    render_pipeline_init(&pipeline, options, &output);
+    RowSink sink = render_pipeline_sink(&pipeline);
+    DecodeOptions decode = {.quality = QUALITY_BALANCED};
+
+    ImageFormat format = detect_format(input->data, input->size);
+    int failed = format == FORMAT_PNG    ? decode_png(input->data, input->size, &decode, &sink)
+                 : format == FORMAT_JPEG ? decode_jpeg(input->data, input->size, &decode, &sink)
+                                         : 1;
+    *columns = pipeline.columns;
+    *rows = pipeline.rows;
+    render_pipeline_free(&pipeline);
+    fclose(out);
+    return failed;
+}
+
+static void print_help(void)
+{
+    printf("Usage:\n"
+           "  vishellize-ptybench [--runs <n>] [--width <columns>] [--parse] [image] [...]\n"
+           "Pushes each image, rendered in every encoder mode, through a pseudo-terminal\n"
+           "(default: Lenna.jpg, sample.png). With --parse the reader also interprets the\n"
+           "escapes with a minimal VT state machine.\n");
+}
+
+// -------------------------------------------------------------
+// MAIN FUNCTION
+// -------------------------------------------------------------
+int main(int argc, char const *argv[])
+{
+    int runs = 7, width = 200, parse = 0;
+    const char *images[64];
+    int image_count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        int has_value = i + 1 < argc;
+
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+        {
+            print_help();
+            return EXIT_SUCCESS;
+        }
+        if (has_value && strcmp(arg, "--runs") == 0)
+            runs = atoi(argv[++i]);
+        else if (has_value && strcmp(arg, "--width") == 0)
+            width = atoi(argv[++i]);
+        else if (strcmp(arg, "--parse") == 0)
+            parse = 1;
+        else if (arg[0] != '-' && image_count < 64)
+            images[image_count++] = arg;
+        else
+        {
+            fprintf(stderr, "Invalid flag '%s'.\n", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (runs < 1 || runs > MAX_RUNS || width < 1)
+    {
+        fprintf(stderr, "Runs must be 1 to %d; width positive.\n", MAX_RUNS);
+        return EXIT_FAILURE;
+    }
+    if (image_count == 0)
+    {
+        images[image_count++] = "Lenna.jpg";
+        images[image_count++] = "sample.png";
+    }
+
+    printf("%-14s %-17s %10s %8s %10s %10s %12s\n", "image", "encoder", "bytes", "cells", "median ms", "MB/s",
+           "Mcells/s");
+
+    int status = EXIT_SUCCESS;
+    for (int i = 0; i < image_count && status == EXIT_SUCCESS; i++)
+    {
+        FILE *file = fopen(images[i], "rb");
+        InputBuffer input;
+        if (file == NULL || input_open(file, &input) || (!input.complete && input_read_rest(file, &input)))
+        {
+            fprintf(stderr, "Couldn't open file '%s'.\n", images[i]);
+            return EXIT_FAILURE;
+        }
+
+        for (int e = 0; e < ENCODER_MODES && status == EXIT_SUCCESS; e++)
+        {
+            const EncoderMode *mode = &encoder_modes[e];
+            RenderOptions options = {.width = width,
+                                     .kernel = RESAMPLE_BOX,
+                                     .colors = mode->colors,
+                                     .dither = mode->dither,
+                                     .sparse = mode->sparse,
+                                     .tolerance = 3};
+            char *text = NULL;
+            size_t length = 0;
+            int columns, rows;
+            double ms[MAX_RUNS];
+            ReaderResult result;
+
+            if (render_to_memory(&input, &options, &text, &length, &columns, &rows))
+            {
+                fprintf(stderr, "Couldn't render %s.\n", images[i]);
+                status = EXIT_FAILURE;
+            }
+            else if (drain_through_pty(text, length, runs, parse, columns, rows + 1, ms, &result))
+                status = EXIT_FAILURE;
+            else
+            {
+                qsort(ms, runs, sizeof(double), compare_ms);
+                double median = ms[runs / 2];
+                size_t cells = (size_t)columns * rows;
+                printf("%-14s %-17s %10zu %8zu %10.2f %10.1f %12.2f\n", images[i], mode->name, length, cells, median,
+                       length / median / 1e3, cells / median / 1e3);
+                if (parse)
+                    printf("%-14s %-17s %10s glyphs %zu, sequences %zu (SGR %zu), screen %08x\n", "", "", "",
+                           result.glyphs, result.sequences, result.sgr, result.checksum);
+            }
+            free(text);
+        }
+
+        input_release(&input);
+        fclose(file);
+    }
+
+    pool_trim();
+    return status;
+}
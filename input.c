@@ -0,0 +1,129 @@
+#include "input.h"
+#include "stats.h"
+#include "trace.h"
+#include "vzc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// -------------------------------------------------------------
+// Helper: Append one chunk from a stream to the growable buffer
+// Returns bytes read, 0 at EOF, -1 on error.
+// -------------------------------------------------------------
+static long input_read_chunk(FILE *file, InputBuffer *input)
+{
+    if (input->capacity - input->size < INPUT_CHUNK_SIZE)
+    {
+        size_t capacity = input->capacity ? input->capacity * 2 : INPUT_CHUNK_SIZE;
+        while (capacity - input->size < INPUT_CHUNK_SIZE)
+            capacity *= 2;
+
+        unsigned char *data = realloc((void *)input->data, capacity);
+        if (data == NULL)
+        {
+            fprintf(stderr, "Couldn't allocate memory for input.\n");
+            return -1;
+        }
+        input->data = data;
+        input->capacity = capacity;
+    }
+
+    int previous = stats_enter(STATS_READ);
+    uint64_t span = trace_begin();
+    size_t bytes_read = fread((unsigned char *)input->data + input->size, 1, INPUT_CHUNK_SIZE, file);
+    trace_end("read", span);
+    stats_leave(previous);
+    stats_add(STATS_BYTES_READ, bytes_read);
+    if (bytes_read == 0 && ferror(file))
+    {
+        fprintf(stderr, "Couldn't read input.\n");
+        return -1;
+    }
+
+    input->size += bytes_read;
+    if (bytes_read == 0)
+        input->complete = 1;
+    return (long)bytes_read;
+}
+
+// -------------------------------------------------------------
+// Open input: mmap regular files, otherwise read just the head
+// -------------------------------------------------------------
+int input_open(FILE *file, InputBuffer *input)
+{
+    memset(input, 0, sizeof(*input));
+
+#ifndef _WIN32
+    int fd = fileno(file);
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            // Decoders walk the file front to back exactly once.
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+            input->data = data;
+            input->size = st.st_size;
+            input->mapped = 1;
+            input->complete = 1;
+            stats_add(STATS_BYTES_READ, input->size);
+            return 0;
+        }
+    }
+#endif
+
+    // Pipes and terminals can't be sized up front; grab the first chunk
+    // so the format can be sniffed, and leave the rest to the decoder.
+    return input_read_chunk(file, input) < 0;
+}
+
+// -------------------------------------------------------------
+// Drain the remainder of a stream into the buffer
+// -------------------------------------------------------------
+int input_read_rest(FILE *file, InputBuffer *input)
+{
+    while (!input->complete)
+    {
+        if (input_read_chunk(file, input) < 0)
+            return 1;
+    }
+    return 0;
+}
+
+void input_release(InputBuffer *input)
+{
+#ifndef _WIN32
+    if (input->mapped)
+        munmap((void *)input->data, input->size);
+    else
+#endif
+        free((void *)input->data);
+
+    memset(input, 0, sizeof(*input));
+}
+
+// -------------------------------------------------------------
+// Detect image format from magic bytes
+// https://en.wikipedia.org/wiki/List_of_file_signatures
+// -------------------------------------------------------------
+ImageFormat detect_format(const unsigned char *data, size_t size)
+{
+    static const unsigned char png_signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static const unsigned char jpeg_signature[] = {0xFF, 0xD8, 0xFF};
+
+    if (size >= sizeof(png_signature) && memcmp(data, png_signature, sizeof(png_signature)) == 0)
+        return FORMAT_PNG;
+    if (size >= sizeof(jpeg_signature) && memcmp(data, jpeg_signature, sizeof(jpeg_signature)) == 0)
+        return FORMAT_JPEG;
+    if (size >= 4 && memcmp(data, VZC_MAGIC, 4) == 0)
+        return FORMAT_VZC;
+
+    return FORMAT_UNKNOWN;
+}
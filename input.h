@@ -0,0 +1,31 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+    FORMAT_UNKNOWN,
+    FORMAT_PNG,
+    FORMAT_JPEG,
+    FORMAT_VZC, // Cell grid saved by vishellize itself
+} ImageFormat;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int mapped;   // Non-zero when data is a read-only mmap of the file
+    int complete; // Non-zero once data holds the whole input
+} InputBuffer;
+
+// Size of each read() from a non-seekable input
+#define INPUT_CHUNK_SIZE (64 * 1024)
+
+int input_open(FILE *file, InputBuffer *input);
+int input_read_rest(FILE *file, InputBuffer *input);
+void input_release(InputBuffer *input);
+
+ImageFormat detect_format(const unsigned char *data, size_t size);
+
+#endif
@@ -0,0 +1,773 @@
+#include "jpeg_handler.h"
+#include "kernels.h"
+#include "pool.h"
+#include "resample.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include <jpeglib.h>
+#include <jerror.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <turbojpeg.h>
+
+// -------------------------------------------------------------
+// Error handling: longjmp back instead of exit()ing
+// -------------------------------------------------------------
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+    // Releases our own buffers if decoding longjmps out part-way
+    void (*cleanup)(void *user);
+    void *cleanup_user;
+} JPEGError;
+
+static void error_exit(j_common_ptr cinfo)
+{
+    JPEGError *err = (JPEGError *)cinfo->err;
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    fprintf(stderr, "Couldn't decompress JPEG: %s.\n", message);
+    longjmp(err->jmp, 1);
+}
+
+// -------------------------------------------------------------
+// Source manager for non-seekable input: the sniffed head first,
+// then fixed-size chunks straight off the stream.
+// -------------------------------------------------------------
+typedef struct {
+    struct jpeg_source_mgr pub;
+    FILE *fp;
+    const unsigned char *head;
+    size_t head_size;
+    JOCTET buffer[JPEG_STREAM_CHUNK_SIZE];
+} JPEGStreamSource;
+
+static void stream_init_source(j_decompress_ptr cinfo)
+{
+    JPEGStreamSource *src = (JPEGStreamSource *)cinfo->src;
+    src->pub.next_input_byte = src->head;
+    src->pub.bytes_in_buffer = src->head_size;
+}
+
+static boolean stream_fill_input_buffer(j_decompress_ptr cinfo)
+{
+    static const JOCTET fake_eoi[] = {0xFF, JPEG_EOI};
+    JPEGStreamSource *src = (JPEGStreamSource *)cinfo->src;
+
+    int previous = stats_enter(STATS_READ);
+    uint64_t span = trace_begin();
+    size_t bytes_read = fread(src->buffer, 1, JPEG_STREAM_CHUNK_SIZE, src->fp);
+    trace_end("read", span);
+    stats_leave(previous);
+    stats_add(STATS_BYTES_READ, bytes_read);
+    if (bytes_read == 0)
+    {
+        // Truncated stream: let libjpeg finish with what it has
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->pub.next_input_byte = fake_eoi;
+        src->pub.bytes_in_buffer = sizeof(fake_eoi);
+        return TRUE;
+    }
+
+    src->pub.next_input_byte = src->buffer;
+    src->pub.bytes_in_buffer = bytes_read;
+    return TRUE;
+}
+
+static void stream_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+    struct jpeg_source_mgr *src = cinfo->src;
+    while (num_bytes > (long)src->bytes_in_buffer)
+    {
+        num_bytes -= (long)src->bytes_in_buffer;
+        (*src->fill_input_buffer)(cinfo);
+    }
+    src->next_input_byte += num_bytes;
+    src->bytes_in_buffer -= num_bytes;
+}
+
+static void stream_term_source(j_decompress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+static void set_stream_source(j_decompress_ptr cinfo, FILE *fp, const unsigned char *head, size_t head_size)
+{
+    JPEGStreamSource *src = (JPEGStreamSource *)(*cinfo->mem->alloc_small)(
+        (j_common_ptr)cinfo, JPOOL_PERMANENT, sizeof(JPEGStreamSource));
+
+    src->pub.init_source = stream_init_source;
+    src->pub.fill_input_buffer = stream_fill_input_buffer;
+    src->pub.skip_input_data = stream_skip_input_data;
+    src->pub.resync_to_restart = jpeg_resync_to_restart;
+    src->pub.term_source = stream_term_source;
+    src->pub.bytes_in_buffer = 0;
+    src->pub.next_input_byte = NULL;
+    src->fp = fp;
+    src->head = head;
+    src->head_size = head_size;
+    cinfo->src = &src->pub;
+}
+
+// -------------------------------------------------------------
+// Helper: Smallest DCT scale (in eighths) that still covers the output.
+// IDCT scaling filters gamma-encoded samples, so under --linear it
+// stops at twice the output and leaves the last 2x to the resampler.
+// -------------------------------------------------------------
+static unsigned int pick_scale(const DecodeOptions *decode, int width, int height, int out_width, int out_height)
+{
+    if (decode->linear)
+    {
+        out_width *= 2;
+        out_height *= 2;
+    }
+
+    for (unsigned int eighths = 1; eighths < 8; eighths++)
+    {
+        if ((long long)width * eighths >= 8LL * out_width && (long long)height * eighths >= 8LL * out_height)
+            return eighths;
+    }
+    return 8;
+}
+
+// -------------------------------------------------------------
+// Helper: Size of the whole-image coefficient arrays that
+// progressive and buffered-image decoding allocate
+// -------------------------------------------------------------
+static size_t coefficient_bytes(j_decompress_ptr cinfo)
+{
+    size_t bytes = 0;
+    for (int ci = 0; ci < cinfo->num_components; ci++)
+    {
+        jpeg_component_info *comp = &cinfo->comp_info[ci];
+        size_t blocks_wide = (cinfo->image_width * (size_t)comp->h_samp_factor + 8 * cinfo->max_h_samp_factor - 1) /
+                             (8 * cinfo->max_h_samp_factor);
+        size_t blocks_high = (cinfo->image_height * (size_t)comp->v_samp_factor + 8 * cinfo->max_v_samp_factor - 1) /
+                             (8 * cinfo->max_v_samp_factor);
+        bytes += blocks_wide * blocks_high * sizeof(JBLOCK);
+    }
+    return bytes;
+}
+
+// -------------------------------------------------------------
+// Helper: The crop region in scaled output coordinates
+// -------------------------------------------------------------
+typedef struct {
+    JDIMENSION x;
+    JDIMENSION y;
+    JDIMENSION width;
+    JDIMENSION height;
+} OutputWindow;
+
+static OutputWindow output_window(j_decompress_ptr cinfo, const Region *region)
+{
+    OutputWindow win;
+    win.x = (JDIMENSION)((long long)region->x * cinfo->output_width / cinfo->image_width);
+    win.y = (JDIMENSION)((long long)region->y * cinfo->output_height / cinfo->image_height);
+    win.width = (JDIMENSION)(((long long)region->width * cinfo->output_width + cinfo->image_width - 1) / cinfo->image_width);
+    win.height = (JDIMENSION)(((long long)region->height * cinfo->output_height + cinfo->image_height - 1) / cinfo->image_height);
+    if (win.width > cinfo->output_width - win.x)
+        win.width = cinfo->output_width - win.x;
+    if (win.height > cinfo->output_height - win.y)
+        win.height = cinfo->output_height - win.y;
+    return win;
+}
+
+// Read output scanlines up to the bottom of the window, handing the rows
+// inside it to the sink. trim skips bytes left of the window. 12-bit
+// frames fill the same rows with 16-bit samples.
+static void read_window(j_decompress_ptr cinfo, const OutputWindow *win, size_t trim, JSAMPARRAY rows,
+                        RowSink *sink)
+{
+    int wide = cinfo->data_precision == 12;
+    JDIMENSION end = win->y + win->height;
+    while (cinfo->output_scanline < end)
+    {
+        JDIMENSION first = cinfo->output_scanline;
+        JDIMENSION wanted = end - first;
+        if (wanted > (JDIMENSION)cinfo->rec_outbuf_height)
+            wanted = cinfo->rec_outbuf_height;
+
+        uint64_t span = trace_begin();
+        JDIMENSION got = wide ? jpeg12_read_scanlines(cinfo, (J12SAMPARRAY)rows, wanted)
+                              : jpeg_read_scanlines(cinfo, rows, wanted);
+        trace_end(wide ? "jpeg12_read_scanlines" : "jpeg_read_scanlines", span);
+        for (JDIMENSION i = 0; i < got; i++)
+        {
+            if (first + i >= win->y)
+                sink->row(sink->user, rows[i] + trim);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Single pass: decode only what the window needs. 12-bit frames
+// take the same path through libjpeg's 12-bit entry points and
+// reach the sink as 16-bit rows.
+// -------------------------------------------------------------
+static int decode_single(j_decompress_ptr cinfo, const Region *region, RowSink *sink)
+{
+    int wide = cinfo->data_precision == 12;
+    if (wide && sink->begin_wide == NULL)
+    {
+        fprintf(stderr, "Couldn't render 12-bit JPEG samples.\n");
+        return 1;
+    }
+
+    jpeg_start_decompress(cinfo);
+    OutputWindow win = output_window(cinfo, region);
+
+    // Only decode the iMCU columns that overlap the window. libjpeg widens
+    // it to iMCU boundaries, so remember how much to trim.
+    JDIMENSION crop_x = win.x, crop_width = win.width;
+    if (win.x > 0 || win.width < cinfo->output_width)
+    {
+        if (wide)
+            jpeg12_crop_scanline(cinfo, &crop_x, &crop_width);
+        else
+            jpeg_crop_scanline(cinfo, &crop_x, &crop_width);
+    }
+    size_t trim = (size_t)(win.x - crop_x) * cinfo->output_components * (wide ? sizeof(J12SAMPLE) : 1);
+
+    if (win.y > 0)
+    {
+        if (wide)
+            jpeg12_skip_scanlines(cinfo, win.y);
+        else
+            jpeg_skip_scanlines(cinfo, win.y);
+    }
+
+    int failed = wide ? sink->begin_wide(sink->user, win.width, win.height, cinfo->output_components, 12)
+                      : sink->begin(sink->user, win.width, win.height, cinfo->output_components);
+    if (failed)
+    {
+        jpeg_abort_decompress(cinfo);
+        return 1;
+    }
+
+    // A few MCU rows of scanlines, freed with the decompressor. At 12 bits
+    // libjpeg sizes the samples itself and hands back J12SAMPLE rows.
+    JSAMPARRAY rows = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                  cinfo->output_width * cinfo->output_components,
+                                                  cinfo->rec_outbuf_height);
+    read_window(cinfo, &win, trim, rows, sink);
+
+    // Rows below the window are never decoded
+    jpeg_abort_decompress(cinfo);
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Planar path for heavy downscales: read the raw Y, Cb and Cr
+// planes at their native (subsampled) resolution, box-filter each
+// straight down to the output grid, and convert only the output
+// cells to RGB. No source pixel is color-converted or upsampled.
+// -------------------------------------------------------------
+typedef struct {
+    Resampler resampler;
+    unsigned char *cells; // Output grid of this plane's samples
+    int rows_done;
+    JDIMENSION x, y, width, height; // Window in plane samples
+} JPEGPlane;
+
+typedef struct {
+    JPEGPlane plane[3];
+    unsigned char *rgb; // One converted output row
+} JPEGPlanes;
+
+static void plane_emit(void *user, const unsigned char *row, int width, int channels)
+{
+    (void)channels;
+    JPEGPlane *plane = user;
+    memcpy(plane->cells + (size_t)plane->rows_done++ * width, row, width);
+}
+
+static void planes_free(void *user)
+{
+    JPEGPlanes *planes = user;
+    for (int ci = 0; ci < 3; ci++)
+    {
+        resampler_free(&planes->plane[ci].resampler);
+        pool_free(planes->plane[ci].cells);
+    }
+    pool_free(planes->rgb);
+}
+
+// Whether the planar path applies and is worth it: a YCbCr image that
+// still needs at least 2x of box filtering after the IDCT scaling. The
+// planes are box filtered as gamma-encoded YCbCr, so other --quality
+// kernels, --linear and 12-bit frames use scanlines.
+static int use_planes(j_decompress_ptr cinfo, const DecodeOptions *decode, const Region *region, int out_width,
+                      int out_height)
+{
+    if (decode->quality != QUALITY_BALANCED || decode->linear || cinfo->jpeg_color_space != JCS_YCbCr ||
+        cinfo->num_components != 3 || cinfo->data_precision != 8)
+        return 0;
+
+    jpeg_calc_output_dimensions(cinfo);
+    long long width = (long long)region->width * cinfo->output_width / cinfo->image_width;
+    long long height = (long long)region->height * cinfo->output_height / cinfo->image_height;
+    return width >= 2LL * out_width && height >= 2LL * out_height;
+}
+
+static int decode_planes(j_decompress_ptr cinfo, const Region *region, RowSink *sink, int out_width, int out_height)
+{
+    cinfo->raw_data_out = TRUE;
+    jpeg_start_decompress(cinfo);
+    OutputWindow win = output_window(cinfo, region);
+
+    JPEGPlanes planes;
+    memset(&planes, 0, sizeof(planes));
+    JPEGError *err = (JPEGError *)cinfo->err;
+    err->cleanup = planes_free;
+    err->cleanup_user = &planes;
+
+    // One iMCU row of every plane, freed with the decompressor
+    JSAMPARRAY rows[3];
+    int failed = 0;
+    for (int ci = 0; ci < 3; ci++)
+    {
+        jpeg_component_info *comp = &cinfo->comp_info[ci];
+        JPEGPlane *plane = &planes.plane[ci];
+
+        // The window, mapped onto this plane's sample grid
+        plane->x = (JDIMENSION)((unsigned long long)win.x * comp->downsampled_width / cinfo->output_width);
+        plane->y = (JDIMENSION)((unsigned long long)win.y * comp->downsampled_height / cinfo->output_height);
+        JDIMENSION right = (JDIMENSION)(((unsigned long long)(win.x + win.width) * comp->downsampled_width +
+                                         cinfo->output_width - 1) / cinfo->output_width);
+        JDIMENSION bottom = (JDIMENSION)(((unsigned long long)(win.y + win.height) * comp->downsampled_height +
+                                          cinfo->output_height - 1) / cinfo->output_height);
+        plane->width = right - plane->x;
+        plane->height = bottom - plane->y;
+
+        rows[ci] = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                               comp->width_in_blocks * comp->DCT_scaled_size,
+                                               comp->v_samp_factor * comp->DCT_scaled_size);
+        plane->cells = pool_alloc((size_t)out_width * out_height);
+        failed |= plane->cells == NULL;
+        failed |= resampler_init(&plane->resampler, RESAMPLE_BOX, plane->width, plane->height, out_width, out_height,
+                                 1, 8, 0, plane_emit, plane);
+    }
+    planes.rgb = pool_alloc((size_t)out_width * 3);
+
+    if (failed || planes.rgb == NULL)
+    {
+        fprintf(stderr, "Couldn't allocate memory for YCbCr planes.\n");
+        failed = 1;
+    }
+    else if (!(failed = sink->begin(sink->user, out_width, out_height, 3)))
+    {
+        JDIMENSION plane_row[3] = {0, 0, 0};
+        int converted = 0;
+        const PixelKernels *kernels = pixel_kernels();
+
+        while (converted < out_height && cinfo->output_scanline < cinfo->output_height)
+        {
+            uint64_t span = trace_begin();
+            jpeg_read_raw_data(cinfo, rows, cinfo->max_v_samp_factor * cinfo->min_DCT_scaled_size);
+            trace_end("jpeg_read_raw_data", span);
+
+            for (int ci = 0; ci < 3; ci++)
+            {
+                jpeg_component_info *comp = &cinfo->comp_info[ci];
+                JPEGPlane *plane = &planes.plane[ci];
+                for (int i = 0; i < comp->v_samp_factor * comp->DCT_scaled_size; i++, plane_row[ci]++)
+                {
+                    if (plane_row[ci] >= plane->y && plane_row[ci] < plane->y + plane->height)
+                        resampler_push_row(&plane->resampler, rows[ci][i] + plane->x);
+                }
+            }
+
+            // Output rows every plane has finished
+            int ready = planes.plane[0].rows_done;
+            for (int ci = 1; ci < 3; ci++)
+            {
+                if (planes.plane[ci].rows_done < ready)
+                    ready = planes.plane[ci].rows_done;
+            }
+            for (; converted < ready; converted++)
+            {
+                size_t offset = (size_t)converted * out_width;
+                kernels->ycc_to_rgb(planes.plane[0].cells + offset, planes.plane[1].cells + offset,
+                                    planes.plane[2].cells + offset, planes.rgb, out_width);
+                sink->row(sink->user, planes.rgb);
+            }
+        }
+    }
+
+    err->cleanup = NULL;
+    planes_free(&planes);
+    jpeg_abort_decompress(cinfo);
+    return failed;
+}
+
+// -------------------------------------------------------------
+// Buffered-image mode: one output pass per completed scan, until
+// the input runs out or the time budget does. This is the same
+// idea as TJPARAM_SCANLIMIT, except that running out stops at the
+// last good scan instead of failing the decode.
+// -------------------------------------------------------------
+static int decode_scans(j_decompress_ptr cinfo, const Region *region, RowSink *sink, const RefineOptions *refine)
+{
+    double start = monotonic_ms();
+
+    cinfo->buffered_image = TRUE;
+    jpeg_start_decompress(cinfo);
+    OutputWindow win = output_window(cinfo, region);
+
+    if (sink->begin(sink->user, win.width, win.height, cinfo->output_components))
+    {
+        jpeg_abort_decompress(cinfo);
+        return 1;
+    }
+
+    JSAMPARRAY rows = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                  cinfo->output_width * cinfo->output_components,
+                                                  cinfo->rec_outbuf_height);
+    size_t trim = (size_t)win.x * cinfo->output_components;
+
+    for (;;)
+    {
+        // Output waits on input, so this pass shows the scan being read
+        jpeg_start_output(cinfo, cinfo->input_scan_number);
+        read_window(cinfo, &win, trim, rows, sink);
+        jpeg_finish_output(cinfo);
+
+        refine->frame_done(refine->user, cinfo->output_scan_number);
+
+        if (jpeg_input_complete(cinfo))
+            break;
+        if (refine->time_budget_ms > 0 && monotonic_ms() - start >= refine->time_budget_ms)
+            break;
+    }
+
+    jpeg_abort_decompress(cinfo);
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Shared entry point, once a source manager is installed.
+// libjpeg errors longjmp out to the caller.
+// -------------------------------------------------------------
+static int run_decoder(j_decompress_ptr cinfo, const DecodeOptions *decode, RowSink *sink, const RefineOptions *refine)
+{
+    jpeg_read_header(cinfo, TRUE);
+
+    Region region = decode->crop;
+    if (region_clamp(&region, cinfo->image_width, cinfo->image_height))
+    {
+        fprintf(stderr, "Crop region lies outside the %ux%u image.\n", cinfo->image_width, cinfo->image_height);
+        return 1;
+    }
+
+    int out_width, out_height;
+    sink->plan(sink->user, region.width, region.height, &out_width, &out_height);
+
+    // Let the IDCT do most of the downscaling for free
+    cinfo->scale_num = pick_scale(decode, region.width, region.height, out_width, out_height);
+    cinfo->scale_denom = 8;
+    // Grayscale stays one byte per pixel
+    cinfo->out_color_space = cinfo->jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+
+    if (decode->quality == QUALITY_FAST)
+    {
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+
+    // Progressive decoding keeps every coefficient of the image in memory
+    // and nothing there can be tiled, so refuse up front. libjpeg also
+    // enforces the budget on its own allocations.
+    if (decode->max_memory > 0)
+    {
+        cinfo->mem->max_memory_to_use = (long)decode->max_memory;
+
+        if (jpeg_has_multiple_scans(cinfo))
+        {
+            size_t coefficients = coefficient_bytes(cinfo);
+            if (exceeds_budget(decode, coefficients))
+            {
+                fprintf(stderr, "Progressive JPEG needs %zu MiB of coefficient buffers, over the %zu MiB budget.\n",
+                        coefficients >> 20, decode->max_memory >> 20);
+                return 1;
+            }
+        }
+    }
+
+    // 12-bit progressive frames are shown once, when complete
+    if (refine && jpeg_has_multiple_scans(cinfo) && cinfo->data_precision == 8)
+        return decode_scans(cinfo, &region, sink, refine);
+
+    int failed = use_planes(cinfo, decode, &region, out_width, out_height)
+                     ? decode_planes(cinfo, &region, sink, out_width, out_height)
+                     : decode_single(cinfo, &region, sink);
+    if (!failed && refine)
+        refine->frame_done(refine->user, 1);
+    return failed;
+}
+
+// Data is either the whole file or, with rest set, the sniffed head of a
+// stream that continues in rest.
+static int turbo_decode(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink,
+                        int preview);
+
+static int decode_source(const unsigned char *data, size_t size, FILE *rest, const DecodeOptions *decode, RowSink *sink,
+                         const RefineOptions *refine)
+{
+    // Lossy JPEGs, 8-bit or 12-bit, go through libjpeg's scanline reader;
+    // TurboJPEG takes lossless ones as one frame, which needs the whole file
+    if (jpeg_lossless(data, size, decode))
+    {
+        if (rest)
+        {
+            fprintf(stderr, "Couldn't stream a lossless JPEG.\n");
+            return 1;
+        }
+        int failed = turbo_decode(data, size, decode, sink, 0);
+        if (!failed && refine)
+            refine->frame_done(refine->user, 1);
+        return failed;
+    }
+
+    struct jpeg_decompress_struct cinfo;
+    JPEGError err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = error_exit;
+
+    err.cleanup = NULL;
+
+    if (setjmp(err.jmp))
+    {
+        if (err.cleanup)
+            err.cleanup(err.cleanup_user);
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if (rest)
+        set_stream_source(&cinfo, rest, data, size);
+    else
+        jpeg_mem_src(&cinfo, data, size);
+
+    int failed = run_decoder(&cinfo, decode, sink, refine);
+
+    jpeg_destroy_decompress(&cinfo);
+    return failed;
+}
+
+int decode_jpeg(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink)
+{
+    return decode_source(data, size, NULL, decode, sink, NULL);
+}
+
+int decode_jpeg_stream(FILE *fp, const unsigned char *head, size_t head_size, const DecodeOptions *decode, RowSink *sink)
+{
+    return decode_source(head, head_size, fp, decode, sink, NULL);
+}
+
+int decode_jpeg_scans(const unsigned char *data, size_t size, FILE *rest, const DecodeOptions *decode, RowSink *sink,
+                      const RefineOptions *refine)
+{
+    return decode_source(data, size, rest, decode, sink, refine);
+}
+
+// -------------------------------------------------------------
+// TurboJPEG frame decode, all in one buffer: lossless frames, which
+// can be neither cropped nor decoded a few rows at a time, and the
+// cropped 1/8-scale preview. A frame over the memory budget is
+// refused; a preview over it is quietly skipped, since the full
+// decode follows anyway. Samples deeper than 8 bits reach the sink
+// as 16-bit rows.
+// -------------------------------------------------------------
+static int tj_decode_frame(tjhandle tj, const unsigned char *data, size_t size, tjscalingfactor scale,
+                           const Region *region, const DecodeOptions *decode, RowSink *sink, int preview)
+{
+    int width = tj3Get(tj, TJPARAM_JPEGWIDTH);
+    int height = tj3Get(tj, TJPARAM_JPEGHEIGHT);
+    int subsamp = tj3Get(tj, TJPARAM_SUBSAMP);
+    int precision = tj3Get(tj, TJPARAM_PRECISION);
+    int lossless = tj3Get(tj, TJPARAM_LOSSLESS) == 1;
+    int scaled_width = TJSCALED(width, scale);
+    int scaled_height = TJSCALED(height, scale);
+
+    // The region in scaled coordinates, at least one pixel
+    int x = (int)((long long)region->x * scaled_width / width);
+    int y = (int)((long long)region->y * scaled_height / height);
+    int region_width = (int)(((long long)region->width * scaled_width + width - 1) / width);
+    int region_height = (int)(((long long)region->height * scaled_height + height - 1) / height);
+    if (x >= scaled_width)
+        x = scaled_width - 1;
+    if (y >= scaled_height)
+        y = scaled_height - 1;
+    if (region_width > scaled_width - x)
+        region_width = scaled_width - x;
+    if (region_height > scaled_height - y)
+        region_height = scaled_height - y;
+
+    // Cropping regions must start on a scaled iMCU column. Lossless
+    // frames are decoded whole.
+    int mcu_width = TJSCALED(subsamp >= 0 ? tjMCUWidth[subsamp] : 32, scale);
+    int crop_x = lossless ? 0 : x - x % mcu_width;
+    int crop_y = lossless ? 0 : y;
+    int crop_width = lossless ? scaled_width : x + region_width - crop_x;
+    int crop_height = lossless ? scaled_height : region_height;
+    int cropped = crop_x > 0 || crop_width < scaled_width || crop_y > 0 || crop_height < scaled_height;
+
+    // Grayscale stays one channel; deep samples take two bytes each
+    int pixel_format = subsamp == TJSAMP_GRAY ? TJPF_GRAY : TJPF_RGB;
+    int channels = tjPixelSize[pixel_format];
+    int pixel_size = channels * (precision > 8 ? 2 : 1);
+
+    size_t row_bytes = (size_t)crop_width * pixel_size;
+    if (exceeds_budget(decode, row_bytes * crop_height))
+    {
+        if (!preview)
+            fprintf(stderr, "Lossless JPEG needs %zu MiB of pixels, over the %zu MiB budget.\n",
+                    (row_bytes * crop_height) >> 20, decode->max_memory >> 20);
+        return 1;
+    }
+
+    if (precision > 8 && sink->begin_wide == NULL)
+    {
+        fprintf(stderr, "Couldn't render %d-bit JPEG samples.\n", precision);
+        return 1;
+    }
+
+    unsigned char *frame = pool_alloc(row_bytes * crop_height);
+    if (frame == NULL)
+    {
+        fprintf(stderr, "Couldn't allocate memory for pixel buffer.\n");
+        return 1;
+    }
+
+    int failed = precision > 8 ? sink->begin_wide(sink->user, region_width, region_height, channels, precision)
+                               : sink->begin(sink->user, region_width, region_height, channels);
+    if (failed)
+    {
+        pool_free(frame);
+        return 1;
+    }
+
+    // A reused instance still holds the last image's region
+    tjregion crop = cropped ? (tjregion){crop_x, crop_y, crop_width, crop_height} : TJUNCROPPED;
+    uint64_t span = trace_begin();
+    if (tj3SetCroppingRegion(tj, crop) < 0)
+        failed = 1;
+    else if (precision <= 8)
+        failed = tj3Decompress8(tj, data, size, frame, 0, pixel_format) < 0;
+    else if (precision <= 12)
+        failed = tj3Decompress12(tj, data, size, (short *)frame, 0, pixel_format) < 0;
+    else
+        failed = tj3Decompress16(tj, data, size, (unsigned short *)frame, 0, pixel_format) < 0;
+    trace_end(precision <= 8 ? "tj3Decompress8" : precision <= 12 ? "tj3Decompress12" : "tj3Decompress16", span);
+
+    if (failed)
+    {
+        fprintf(stderr, "Couldn't decompress image into pixel buffer: %s.\n", tj3GetErrorStr(tj));
+        pool_free(frame);
+        return 1;
+    }
+
+    const unsigned char *first = frame + (size_t)(y - crop_y) * row_bytes + (size_t)(x - crop_x) * pixel_size;
+    for (int row = 0; row < region_height; row++)
+        sink->row(sink->user, first + row * row_bytes);
+
+    pool_free(frame);
+    return 0;
+}
+
+// The caller's instance when it lends one, else a fresh one
+static tjhandle turbo_acquire(const DecodeOptions *decode)
+{
+    return decode->turbojpeg ? decode->turbojpeg : tj3Init(TJINIT_DECOMPRESS);
+}
+
+static void turbo_release(const DecodeOptions *decode, tjhandle tj)
+{
+    if (tj != decode->turbojpeg)
+        tj3Destroy(tj);
+}
+
+// -------------------------------------------------------------
+// Whole TurboJPEG decode: the 1/8-scale preview, and lossless
+// images, which libjpeg's scanline reader can't crop. For a preview
+// the sink is planned against the full-size region, so the tiny
+// image is stretched to the same grid the full decode will fill.
+// -------------------------------------------------------------
+static int turbo_decode(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink,
+                        int preview)
+{
+    tjhandle tj = turbo_acquire(decode);
+    if (tj == NULL)
+    {
+        fprintf(stderr, "Couldn't create TurboJPEG instance: %s.\n", tj3GetErrorStr(tj));
+        return 1;
+    }
+
+    if (tj3DecompressHeader(tj, data, size) < 0)
+    {
+        fprintf(stderr, "Couldn't decompress JPEG header: %s.\n", tj3GetErrorStr(tj));
+        turbo_release(decode, tj);
+        return 1;
+    }
+
+    int width = tj3Get(tj, TJPARAM_JPEGWIDTH);
+    int height = tj3Get(tj, TJPARAM_JPEGHEIGHT);
+
+    Region region = decode->crop;
+    if (region_clamp(&region, width, height))
+    {
+        fprintf(stderr, "Crop region lies outside the %dx%d image.\n", width, height);
+        turbo_release(decode, tj);
+        return 1;
+    }
+
+    int out_width, out_height;
+    sink->plan(sink->user, region.width, region.height, &out_width, &out_height);
+
+    // TurboJPEG enforces the budget on its own intermediate buffers (0 =
+    // none, which a reused instance needs to be told again)
+    tj3Set(tj, TJPARAM_MAXMEMORY, (int)((decode->max_memory + (1 << 20) - 1) >> 20));
+
+    // Speed matters more than accuracy for a placeholder, unless asked.
+    // Lossless images have no IDCT to scale or speed up.
+    tjscalingfactor scale = {1, 8};
+    if (tj3Get(tj, TJPARAM_LOSSLESS) == 1)
+        scale = TJUNSCALED;
+    else if (!preview)
+        scale.num = (int)pick_scale(decode, region.width, region.height, out_width, out_height);
+
+    int fast = preview ? decode->quality != QUALITY_BEST : decode->quality == QUALITY_FAST;
+    tj3Set(tj, TJPARAM_FASTDCT, fast);
+    tj3Set(tj, TJPARAM_FASTUPSAMPLE, fast);
+    if (tj3SetScalingFactor(tj, scale) < 0)
+    {
+        fprintf(stderr, "Couldn't set JPEG scaling factor: %s.\n", tj3GetErrorStr(tj));
+        turbo_release(decode, tj);
+        return 1;
+    }
+
+    int failed = tj_decode_frame(tj, data, size, scale, &region, decode, sink, preview);
+
+    turbo_release(decode, tj);
+    return failed;
+}
+
+int decode_jpeg_preview(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink)
+{
+    return turbo_decode(data, size, decode, sink, 1);
+}
+
+int jpeg_lossless(const unsigned char *data, size_t size, const DecodeOptions *decode)
+{
+    tjhandle tj = turbo_acquire(decode);
+    if (tj == NULL)
+        return 0;
+
+    int lossless = tj3DecompressHeader(tj, data, size) == 0 && tj3Get(tj, TJPARAM_LOSSLESS) == 1;
+    turbo_release(decode, tj);
+    return lossless;
+}
@@ -0,0 +1,32 @@
+#ifndef JPEG_HANDLER_H
+#define JPEG_HANDLER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "row_sink.h"
+
+// Bytes handed to libjpeg per read from a stream
+#define JPEG_STREAM_CHUNK_SIZE (64 * 1024)
+
+// Both decoders push RGB rows of the cropped region into the sink a few
+// scanlines at a time (8-bit, or 16-bit for deeper samples) and return 0 on
+// success.
+int decode_jpeg(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink);
+int decode_jpeg_stream(FILE *fp, const unsigned char *head, size_t head_size, const DecodeOptions *decode, RowSink *sink);
+
+// Progressive JPEGs are decoded in buffered-image mode and every completed
+// scan is pushed through the sink as a frame; other JPEGs produce one frame.
+// With rest set, data is the sniffed head of the stream rest.
+int decode_jpeg_scans(const unsigned char *data, size_t size, FILE *rest, const DecodeOptions *decode, RowSink *sink,
+                      const RefineOptions *refine);
+
+// True for lossless JPEGs (8 to 16 bits per sample). Those are decoded
+// through TurboJPEG from one contiguous buffer, so streamed input has to be
+// read in full first.
+int jpeg_lossless(const unsigned char *data, size_t size, const DecodeOptions *decode);
+
+// Decodes at 1/8 scale with TurboJPEG's fast IDCT and upsampling, for an
+// immediate low-quality preview. Plans the sink against the full size.
+int decode_jpeg_preview(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink);
+
+#endif
@@ -0,0 +1,1093 @@
+#include "kernels.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// -------------------------------------------------------------
+// Scalar: the reference, and the tail of every wider variant
+// -------------------------------------------------------------
+static int32_t dot_u8_scalar(const int16_t *w, const unsigned char *p, int n)
+{
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += w[i] * p[i];
+    return sum;
+}
+
+static int32_t dot_u16_scalar(const int16_t *w, const uint16_t *p, int n)
+{
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += w[i] * p[i];
+    return sum;
+}
+
+static uint32_t sum_u16_scalar(const uint16_t *p, int n)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += p[i];
+    return sum;
+}
+
+static void premultiply_rgba_scalar(const unsigned char *rgba, uint16_t *planes, int stride, int n)
+{
+    for (int i = 0; i < n; i++, rgba += 4)
+    {
+        planes[i] = (uint16_t)(rgba[0] * rgba[3]);
+        planes[stride + i] = (uint16_t)(rgba[1] * rgba[3]);
+        planes[2 * stride + i] = (uint16_t)(rgba[2] * rgba[3]);
+        planes[3 * stride + i] = rgba[3];
+    }
+}
+
+static void accumulate_u16_scalar(uint32_t *sums, const uint16_t *row, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        sums[i] += row[i];
+}
+
+static unsigned char clamp_u8(int v)
+{
+    return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+static void ycc_to_rgb_scalar(const unsigned char *y, const unsigned char *cb, const unsigned char *cr,
+                              unsigned char *rgb, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int luma = (y[i] << 16) + 32768;
+        int blue_diff = cb[i] - 128;
+        int red_diff = cr[i] - 128;
+        rgb[i * 3 + 0] = clamp_u8((luma + 91881 * red_diff) >> 16);
+        rgb[i * 3 + 1] = clamp_u8((luma - 22554 * blue_diff - 46802 * red_diff) >> 16);
+        rgb[i * 3 + 2] = clamp_u8((luma + 116130 * blue_diff) >> 16);
+    }
+}
+
+// The cube's levels are 0, 95, 135, 175, 215 and 255; the gray ramp's
+// 24 steps run from 8 to 238
+static int cube_index(int v)
+{
+    return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40;
+}
+
+static int cube_level(int index)
+{
+    return index ? 55 + 40 * index : 0;
+}
+
+static int distance(int r, int g, int b, int lr, int lg, int lb)
+{
+    return (r - lr) * (r - lr) + (g - lg) * (g - lg) + (b - lb) * (b - lb);
+}
+
+static unsigned char color_256(int r, int g, int b)
+{
+    int ri = cube_index(r), gi = cube_index(g), bi = cube_index(b);
+    int cube_distance = distance(r, g, b, cube_level(ri), cube_level(gi), cube_level(bi));
+
+    int average = (r + g + b) / 3;
+    int step = average < 8 ? 0 : average > 238 ? 23 : (average - 3) / 10;
+    int level = 8 + 10 * step;
+
+    if (distance(r, g, b, level, level, level) < cube_distance)
+        return (unsigned char)(232 + step);
+    return (unsigned char)(16 + 36 * ri + 6 * gi + bi);
+}
+
+static void quantize_256_scalar(const unsigned char *pixels, int channels, const signed char *dither,
+                                unsigned char *indices, int n)
+{
+    const int g = channels >= 3 ? 1 : 0, b = channels >= 3 ? 2 : 0;
+    for (int i = 0; i < n; i++, pixels += channels)
+    {
+        if (dither)
+        {
+            int offset = dither[i & 3];
+            indices[i] = (unsigned char)(16 + 36 * cube_index(clamp_u8(pixels[0] + offset)) +
+                                         6 * cube_index(clamp_u8(pixels[g] + offset)) +
+                                         cube_index(clamp_u8(pixels[b] + offset)));
+        }
+        else
+        {
+            indices[i] = color_256(pixels[0], pixels[g], pixels[b]);
+        }
+    }
+}
+
+#ifdef KERNELS_X86
+// -------------------------------------------------------------
+// x86: widen bytes to 16 bits and PMADDWD them with the weights.
+// 16-bit samples are too wide for PMADDWD's signed operands, so
+// they are biased by -32768 and the weights times 32768 added
+// back; the 32-bit sums wrap, but the final total fits. The 256-
+// and 512-bit variants clear the upper register halves
+// (VZEROUPPER) before handing the tail to narrower code: GCC won't
+// do it for target() functions, and mixing dirty upper state with
+// legacy SSE code costs far more than these loops save.
+// -------------------------------------------------------------
+__attribute__((target("sse4.1"))) static int32_t dot_u8_sse41(const int16_t *w, const unsigned char *p, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i samples = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(p + i)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(w + i)), samples));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc) + dot_u8_scalar(w + i, p + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static int32_t dot_u16_sse41(const int16_t *w, const uint16_t *p, int n)
+{
+    const __m128i bias = _mm_set1_epi16(-32768), ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128(), weights = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i wi = _mm_loadu_si128((const __m128i *)(w + i));
+        __m128i samples = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(wi, samples));
+        weights = _mm_add_epi32(weights, _mm_madd_epi16(wi, ones));
+    }
+    acc = _mm_add_epi32(acc, _mm_slli_epi32(weights, 15));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc) + dot_u16_scalar(w + i, p + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static uint32_t sum_u16_sse41(const uint16_t *p, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *)(p + i));
+        acc = _mm_add_epi32(acc, _mm_cvtepu16_epi32(samples));
+        acc = _mm_add_epi32(acc, _mm_cvtepu16_epi32(_mm_srli_si128(samples, 8)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(acc) + sum_u16_scalar(p + i, n - i);
+}
+
+// Shuffling each 4-pixel load to RRRRGGGGBBBBAAAA and interleaving two
+// of them by 32 bits puts eight of each channel side by side
+__attribute__((target("sse4.1"))) static void premultiply_rgba_sse41(const unsigned char *rgba, uint16_t *planes,
+                                                                     int stride, int n)
+{
+    const __m128i gather = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i first = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgba + i * 4)), gather);
+        __m128i second = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgba + i * 4 + 16)), gather);
+        __m128i rg = _mm_unpacklo_epi32(first, second), ba = _mm_unpackhi_epi32(first, second);
+        __m128i alpha = _mm_cvtepu8_epi16(_mm_srli_si128(ba, 8));
+        _mm_storeu_si128((__m128i *)(planes + i), _mm_mullo_epi16(_mm_cvtepu8_epi16(rg), alpha));
+        _mm_storeu_si128((__m128i *)(planes + stride + i), _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(rg, 8)), alpha));
+        _mm_storeu_si128((__m128i *)(planes + 2 * stride + i), _mm_mullo_epi16(_mm_cvtepu8_epi16(ba), alpha));
+        _mm_storeu_si128((__m128i *)(planes + 3 * stride + i), alpha);
+    }
+    premultiply_rgba_scalar(rgba + i * 4, planes + i, stride, n - i);
+}
+
+__attribute__((target("sse4.1"))) static void accumulate_u16_sse41(uint32_t *sums, const uint16_t *row, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i low = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(sums + i)), _mm_cvtepu16_epi32(samples));
+        __m128i high = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(sums + i + 4)),
+                                     _mm_cvtepu16_epi32(_mm_srli_si128(samples, 8)));
+        _mm_storeu_si128((__m128i *)(sums + i), low);
+        _mm_storeu_si128((__m128i *)(sums + i + 4), high);
+    }
+    accumulate_u16_scalar(sums + i, row + i, n - i);
+}
+
+// Sixteen pixels of planar RGB bytes to 48 interleaved ones, and back:
+// each output register gathers its bytes from three inputs
+__attribute__((target("sse4.1"))) static inline __m128i gather3_sse41(__m128i a, __m128i a_mask, __m128i b,
+                                                                      __m128i b_mask, __m128i c, __m128i c_mask)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a_mask), _mm_shuffle_epi8(b, b_mask)),
+                        _mm_shuffle_epi8(c, c_mask));
+}
+
+__attribute__((target("sse4.1"))) static inline void interleave_rgb_sse41(__m128i r, __m128i g, __m128i b,
+                                                                          unsigned char *rgb)
+{
+    const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    __m128i first = gather3_sse41(r, r0, g, g0, b, b0);
+    __m128i second = gather3_sse41(r, r1, g, g1, b, b1);
+    __m128i third = gather3_sse41(r, r2, g, g2, b, b2);
+    _mm_storeu_si128((__m128i *)rgb, first);
+    _mm_storeu_si128((__m128i *)(rgb + 16), second);
+    _mm_storeu_si128((__m128i *)(rgb + 32), third);
+}
+
+__attribute__((target("sse4.1"))) static inline void deinterleave_rgb_sse41(const unsigned char *rgb, __m128i *r,
+                                                                            __m128i *g, __m128i *b)
+{
+    const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    __m128i first = _mm_loadu_si128((const __m128i *)rgb);
+    __m128i second = _mm_loadu_si128((const __m128i *)(rgb + 16));
+    __m128i third = _mm_loadu_si128((const __m128i *)(rgb + 32));
+    *r = gather3_sse41(first, r0, second, r1, third, r2);
+    *g = gather3_sse41(first, g0, second, g1, third, g2);
+    *b = gather3_sse41(first, b0, second, b1, third, b2);
+}
+
+// The 16.16 products split into whole multiples of the differences,
+// added in 16 bits, and fractions under 0.5, taken from (Cb, Cr) pairs
+// with PMADDWD: R = Y + Cr + (0.402 Cr), G = Y - Cr + (0.286 Cr -
+// 0.344 Cb), B = Y + 2 Cb - (0.228 Cb). Both round the same way, and
+// PACKUSWB clamps like the scalar code.
+__attribute__((target("sse4.1"))) static inline __m128i ycc_fraction_sse41(__m128i low, __m128i high, __m128i weights)
+{
+    const __m128i half = _mm_set1_epi32(32768);
+    low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(low, weights), half), 16);
+    high = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(high, weights), half), 16);
+    return _mm_packs_epi32(low, high);
+}
+
+__attribute__((target("sse4.1"))) static void ycc_to_rgb_sse41(const unsigned char *y, const unsigned char *cb,
+                                                               const unsigned char *cr, unsigned char *rgb, int n)
+{
+    const __m128i center = _mm_set1_epi16(128);
+    const __m128i red_weights = _mm_set1_epi32(26345 << 16); // (Cb, Cr) pairs
+    const __m128i green_weights = _mm_set1_epi32((18734 << 16) | (uint16_t)-22554);
+    const __m128i blue_weights = _mm_set1_epi32((uint16_t)-14942);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i luma8 = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i blue8 = _mm_loadu_si128((const __m128i *)(cb + i));
+        __m128i red8 = _mm_loadu_si128((const __m128i *)(cr + i));
+        __m128i red[2], green[2], blue[2];
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i luma = _mm_cvtepu8_epi16(luma8);
+            __m128i blue_diff = _mm_sub_epi16(_mm_cvtepu8_epi16(blue8), center);
+            __m128i red_diff = _mm_sub_epi16(_mm_cvtepu8_epi16(red8), center);
+            __m128i low = _mm_unpacklo_epi16(blue_diff, red_diff), high = _mm_unpackhi_epi16(blue_diff, red_diff);
+            red[h] = _mm_add_epi16(_mm_add_epi16(luma, red_diff), ycc_fraction_sse41(low, high, red_weights));
+            green[h] = _mm_add_epi16(_mm_sub_epi16(luma, red_diff), ycc_fraction_sse41(low, high, green_weights));
+            blue[h] = _mm_add_epi16(_mm_add_epi16(luma, _mm_add_epi16(blue_diff, blue_diff)),
+                                    ycc_fraction_sse41(low, high, blue_weights));
+            luma8 = _mm_srli_si128(luma8, 8);
+            blue8 = _mm_srli_si128(blue8, 8);
+            red8 = _mm_srli_si128(red8, 8);
+        }
+        interleave_rgb_sse41(_mm_packus_epi16(red[0], red[1]), _mm_packus_epi16(green[0], green[1]),
+                             _mm_packus_epi16(blue[0], blue[1]), rgb + i * 3);
+    }
+    ycc_to_rgb_scalar(y + i, cb + i, cr + i, rgb + i * 3, n - i);
+}
+
+// xterm 256 colors in 16-bit lanes. A cube index is the count of the
+// thresholds 48, 115, 155, 195 and 235 a channel reaches. Squared
+// distances fit 16 bits unsigned (the gray one stays under 45000), so
+// the scalar comparison carries over as is.
+__attribute__((target("sse4.1"))) static inline __m128i cube_index_sse41(__m128i v)
+{
+    __m128i count = _mm_cmpgt_epi16(v, _mm_set1_epi16(47));
+    count = _mm_add_epi16(count, _mm_cmpgt_epi16(v, _mm_set1_epi16(114)));
+    count = _mm_add_epi16(count, _mm_cmpgt_epi16(v, _mm_set1_epi16(154)));
+    count = _mm_add_epi16(count, _mm_cmpgt_epi16(v, _mm_set1_epi16(194)));
+    count = _mm_add_epi16(count, _mm_cmpgt_epi16(v, _mm_set1_epi16(234)));
+    return _mm_sub_epi16(_mm_setzero_si128(), count);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i cube_distance_sse41(__m128i v, __m128i index)
+{
+    __m128i level = _mm_add_epi16(_mm_mullo_epi16(index, _mm_set1_epi16(40)), _mm_set1_epi16(55));
+    __m128i diff = _mm_sub_epi16(v, _mm_and_si128(level, _mm_cmpgt_epi16(index, _mm_setzero_si128())));
+    return _mm_mullo_epi16(diff, diff);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i quantize_sse41(__m128i r, __m128i g, __m128i b,
+                                                                       const __m128i *dither)
+{
+    const __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16(255);
+    if (dither)
+    {
+        r = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(r, *dither), zero), max);
+        g = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(g, *dither), zero), max);
+        b = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(b, *dither), zero), max);
+    }
+    __m128i ri = cube_index_sse41(r), gi = cube_index_sse41(g), bi = cube_index_sse41(b);
+    __m128i cube = _mm_add_epi16(_mm_mullo_epi16(ri, _mm_set1_epi16(36)), _mm_mullo_epi16(gi, _mm_set1_epi16(6)));
+    cube = _mm_add_epi16(cube, _mm_add_epi16(bi, _mm_set1_epi16(16)));
+    if (dither)
+        return cube;
+
+    __m128i cube_distance = _mm_add_epi16(_mm_add_epi16(cube_distance_sse41(r, ri), cube_distance_sse41(g, gi)),
+                                          cube_distance_sse41(b, bi));
+    __m128i average = _mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(r, g), b), _mm_set1_epi16(21846));
+    __m128i step = _mm_min_epi16(_mm_mulhi_epu16(_mm_subs_epu16(average, _mm_set1_epi16(3)), _mm_set1_epi16(6554)),
+                                 _mm_set1_epi16(23));
+    __m128i level = _mm_add_epi16(_mm_mullo_epi16(step, _mm_set1_epi16(10)), _mm_set1_epi16(8));
+    __m128i dr = _mm_sub_epi16(r, level), dg = _mm_sub_epi16(g, level), db = _mm_sub_epi16(b, level);
+    __m128i gray_distance = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dr, dr), _mm_mullo_epi16(dg, dg)),
+                                          _mm_mullo_epi16(db, db));
+    __m128i closer = _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(cube_distance, gray_distance), zero),
+                                   _mm_set1_epi16(-1));
+    return _mm_blendv_epi8(cube, _mm_add_epi16(step, _mm_set1_epi16(232)), closer);
+}
+
+// dither[i % 4] in every 16-bit lane i
+__attribute__((target("sse4.1"))) static inline __m128i dither_offsets_sse41(const signed char *dither)
+{
+    if (dither == NULL)
+        return _mm_setzero_si128();
+    return _mm_setr_epi16(dither[0], dither[1], dither[2], dither[3], dither[0], dither[1], dither[2], dither[3]);
+}
+
+// Only RGB rows are deinterleaved; gray and wider pixels take the scalar loop
+__attribute__((target("sse4.1"))) static void quantize_256_sse41(const unsigned char *pixels, int channels,
+                                                                 const signed char *dither, unsigned char *indices,
+                                                                 int n)
+{
+    int i = 0;
+    if (channels == 3)
+    {
+        __m128i offsets = dither_offsets_sse41(dither);
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i r, g, b;
+            deinterleave_rgb_sse41(pixels + i * 3, &r, &g, &b);
+            __m128i low = quantize_sse41(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(b),
+                                         dither ? &offsets : NULL);
+            r = _mm_srli_si128(r, 8);
+            g = _mm_srli_si128(g, 8);
+            b = _mm_srli_si128(b, 8);
+            __m128i high = quantize_sse41(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(b),
+                                          dither ? &offsets : NULL);
+            _mm_storeu_si128((__m128i *)(indices + i), _mm_packus_epi16(low, high));
+        }
+    }
+    quantize_256_scalar(pixels + i * channels, channels, dither, indices + i, n - i);
+}
+
+__attribute__((target("avx2"))) static int32_t dot_u8_avx2(const int16_t *w, const unsigned char *p, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i samples = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(w + i)), samples));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(half);
+    _mm256_zeroupper();
+    return sum + dot_u8_sse41(w + i, p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static int32_t dot_u16_avx2(const int16_t *w, const uint16_t *p, int n)
+{
+    const __m256i bias = _mm256_set1_epi16(-32768), ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256(), weights = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i wi = _mm256_loadu_si256((const __m256i *)(w + i));
+        __m256i samples = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), bias);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(wi, samples));
+        weights = _mm256_add_epi32(weights, _mm256_madd_epi16(wi, ones));
+    }
+    acc = _mm256_add_epi32(acc, _mm256_slli_epi32(weights, 15));
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(half);
+    _mm256_zeroupper();
+    return sum + dot_u16_sse41(w + i, p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static uint32_t sum_u16_avx2(const uint16_t *p, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i samples = _mm256_loadu_si256((const __m256i *)(p + i));
+        acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(samples)));
+        acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(samples, 1)));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t sum = (uint32_t)_mm_cvtsi128_si32(half);
+    _mm256_zeroupper();
+    return sum + sum_u16_sse41(p + i, n - i);
+}
+
+// The same per 128-bit lane, then a cross-lane permute and 64-bit
+// interleave: sixteen of each channel
+__attribute__((target("avx2"))) static void premultiply_rgba_avx2(const unsigned char *rgba, uint16_t *planes,
+                                                                  int stride, int n)
+{
+    const __m256i gather = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9,
+                                            13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i first = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(rgba + i * 4)), gather);
+        __m256i second = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(rgba + i * 4 + 32)), gather);
+        first = _mm256_permutevar8x32_epi32(first, order);   // 8 R, 8 G | 8 B, 8 A
+        second = _mm256_permutevar8x32_epi32(second, order); // The next 8 of each
+        __m256i rb = _mm256_unpacklo_epi64(first, second), ga = _mm256_unpackhi_epi64(first, second);
+        __m256i alpha = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(ga, 1));
+        __m256i red = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(rb));
+        __m256i green = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(ga));
+        __m256i blue = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(rb, 1));
+        _mm256_storeu_si256((__m256i *)(planes + i), _mm256_mullo_epi16(red, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + stride + i), _mm256_mullo_epi16(green, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + 2 * stride + i), _mm256_mullo_epi16(blue, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + 3 * stride + i), alpha);
+    }
+    _mm256_zeroupper();
+    premultiply_rgba_sse41(rgba + i * 4, planes + i, stride, n - i);
+}
+
+__attribute__((target("avx2"))) static void accumulate_u16_avx2(uint32_t *sums, const uint16_t *row, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i samples = _mm256_loadu_si256((const __m256i *)(row + i));
+        __m256i low = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(sums + i)),
+                                       _mm256_cvtepu16_epi32(_mm256_castsi256_si128(samples)));
+        __m256i high = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(sums + i + 8)),
+                                        _mm256_cvtepu16_epi32(_mm256_extracti128_si256(samples, 1)));
+        _mm256_storeu_si256((__m256i *)(sums + i), low);
+        _mm256_storeu_si256((__m256i *)(sums + i + 8), high);
+    }
+    _mm256_zeroupper();
+    accumulate_u16_sse41(sums + i, row + i, n - i);
+}
+
+// Sixteen pixels a register; the in-lane unpack and pack undo each other
+__attribute__((target("avx2"))) static inline __m256i ycc_fraction_avx2(__m256i low, __m256i high, __m256i weights)
+{
+    const __m256i half = _mm256_set1_epi32(32768);
+    low = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(low, weights), half), 16);
+    high = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(high, weights), half), 16);
+    return _mm256_packs_epi32(low, high);
+}
+
+__attribute__((target("avx2"))) static inline __m128i pack_u8_avx2(__m256i v)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2"))) static void ycc_to_rgb_avx2(const unsigned char *y, const unsigned char *cb,
+                                                            const unsigned char *cr, unsigned char *rgb, int n)
+{
+    const __m256i center = _mm256_set1_epi16(128);
+    const __m256i red_weights = _mm256_set1_epi32(26345 << 16);
+    const __m256i green_weights = _mm256_set1_epi32((18734 << 16) | (uint16_t)-22554);
+    const __m256i blue_weights = _mm256_set1_epi32((uint16_t)-14942);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + i)));
+        __m256i blue_diff = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cb + i))), center);
+        __m256i red_diff = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cr + i))), center);
+        __m256i low = _mm256_unpacklo_epi16(blue_diff, red_diff), high = _mm256_unpackhi_epi16(blue_diff, red_diff);
+        __m256i red = _mm256_add_epi16(_mm256_add_epi16(luma, red_diff), ycc_fraction_avx2(low, high, red_weights));
+        __m256i green = _mm256_add_epi16(_mm256_sub_epi16(luma, red_diff), ycc_fraction_avx2(low, high, green_weights));
+        __m256i blue = _mm256_add_epi16(_mm256_add_epi16(luma, _mm256_add_epi16(blue_diff, blue_diff)),
+                                        ycc_fraction_avx2(low, high, blue_weights));
+        interleave_rgb_sse41(pack_u8_avx2(red), pack_u8_avx2(green), pack_u8_avx2(blue), rgb + i * 3);
+    }
+    _mm256_zeroupper();
+    ycc_to_rgb_scalar(y + i, cb + i, cr + i, rgb + i * 3, n - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i cube_index_avx2(__m256i v)
+{
+    __m256i count = _mm256_cmpgt_epi16(v, _mm256_set1_epi16(47));
+    count = _mm256_add_epi16(count, _mm256_cmpgt_epi16(v, _mm256_set1_epi16(114)));
+    count = _mm256_add_epi16(count, _mm256_cmpgt_epi16(v, _mm256_set1_epi16(154)));
+    count = _mm256_add_epi16(count, _mm256_cmpgt_epi16(v, _mm256_set1_epi16(194)));
+    count = _mm256_add_epi16(count, _mm256_cmpgt_epi16(v, _mm256_set1_epi16(234)));
+    return _mm256_sub_epi16(_mm256_setzero_si256(), count);
+}
+
+__attribute__((target("avx2"))) static inline __m256i cube_distance_avx2(__m256i v, __m256i index)
+{
+    __m256i level = _mm256_add_epi16(_mm256_mullo_epi16(index, _mm256_set1_epi16(40)), _mm256_set1_epi16(55));
+    __m256i diff = _mm256_sub_epi16(v, _mm256_and_si256(level, _mm256_cmpgt_epi16(index, _mm256_setzero_si256())));
+    return _mm256_mullo_epi16(diff, diff);
+}
+
+__attribute__((target("avx2"))) static inline __m256i quantize_avx2(__m256i r, __m256i g, __m256i b,
+                                                                    const __m256i *dither)
+{
+    const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16(255);
+    if (dither)
+    {
+        r = _mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(r, *dither), zero), max);
+        g = _mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(g, *dither), zero), max);
+        b = _mm256_min_epi16(_mm256_max_epi16(_mm256_add_epi16(b, *dither), zero), max);
+    }
+    __m256i ri = cube_index_avx2(r), gi = cube_index_avx2(g), bi = cube_index_avx2(b);
+    __m256i cube = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(ri, _mm256_set1_epi16(36)), _mm256_mullo_epi16(gi, _mm256_set1_epi16(6))),
+        _mm256_add_epi16(bi, _mm256_set1_epi16(16)));
+    if (dither)
+        return cube;
+
+    __m256i cube_distance = _mm256_add_epi16(_mm256_add_epi16(cube_distance_avx2(r, ri), cube_distance_avx2(g, gi)),
+                                             cube_distance_avx2(b, bi));
+    __m256i average = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_add_epi16(r, g), b), _mm256_set1_epi16(21846));
+    __m256i step = _mm256_min_epi16(
+        _mm256_mulhi_epu16(_mm256_subs_epu16(average, _mm256_set1_epi16(3)), _mm256_set1_epi16(6554)),
+        _mm256_set1_epi16(23));
+    __m256i level = _mm256_add_epi16(_mm256_mullo_epi16(step, _mm256_set1_epi16(10)), _mm256_set1_epi16(8));
+    __m256i dr = _mm256_sub_epi16(r, level), dg = _mm256_sub_epi16(g, level), db = _mm256_sub_epi16(b, level);
+    __m256i gray_distance = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(dr, dr), _mm256_mullo_epi16(dg, dg)), _mm256_mullo_epi16(db, db));
+    __m256i closer = _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_subs_epu16(cube_distance, gray_distance), zero),
+                                      _mm256_set1_epi16(-1));
+    return _mm256_blendv_epi8(cube, _mm256_add_epi16(step, _mm256_set1_epi16(232)), closer);
+}
+
+__attribute__((target("avx2"))) static void quantize_256_avx2(const unsigned char *pixels, int channels,
+                                                              const signed char *dither, unsigned char *indices, int n)
+{
+    int i = 0;
+    if (channels == 3)
+    {
+        __m256i offsets = _mm256_broadcastsi128_si256(dither_offsets_sse41(dither));
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i r, g, b;
+            deinterleave_rgb_sse41(pixels + i * 3, &r, &g, &b);
+            __m256i v = quantize_avx2(_mm256_cvtepu8_epi16(r), _mm256_cvtepu8_epi16(g), _mm256_cvtepu8_epi16(b),
+                                      dither ? &offsets : NULL);
+            _mm_storeu_si128((__m128i *)(indices + i), pack_u8_avx2(v));
+        }
+        _mm256_zeroupper();
+    }
+    quantize_256_scalar(pixels + i * channels, channels, dither, indices + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static int32_t dot_u8_avx512(const int16_t *w, const unsigned char *p,
+                                                                         int n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i samples = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(p + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_loadu_si512(w + i), samples));
+    }
+    int32_t sum = _mm512_reduce_add_epi32(acc);
+    _mm256_zeroupper();
+    return sum + dot_u8_avx2(w + i, p + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static int32_t dot_u16_avx512(const int16_t *w, const uint16_t *p, int n)
+{
+    const __m512i bias = _mm512_set1_epi16(-32768), ones = _mm512_set1_epi16(1);
+    __m512i acc = _mm512_setzero_si512(), weights = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i wi = _mm512_loadu_si512(w + i);
+        __m512i samples = _mm512_xor_si512(_mm512_loadu_si512(p + i), bias);
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(wi, samples));
+        weights = _mm512_add_epi32(weights, _mm512_madd_epi16(wi, ones));
+    }
+    int32_t sum = _mm512_reduce_add_epi32(_mm512_add_epi32(acc, _mm512_slli_epi32(weights, 15)));
+    _mm256_zeroupper();
+    return sum + dot_u16_avx2(w + i, p + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint32_t sum_u16_avx512(const uint16_t *p, int n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i samples = _mm512_loadu_si512(p + i);
+        acc = _mm512_add_epi32(acc, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(samples)));
+        acc = _mm512_add_epi32(acc, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(samples, 1)));
+    }
+    uint32_t sum = (uint32_t)_mm512_reduce_add_epi32(acc);
+    _mm256_zeroupper();
+    return sum + sum_u16_avx2(p + i, n - i);
+}
+
+// Sixteen pixels fill one register, so one permute across all four
+// lanes sorts them by channel
+__attribute__((target("avx512f,avx512bw"))) static void premultiply_rgba_avx512(const unsigned char *rgba,
+                                                                               uint16_t *planes, int stride, int n)
+{
+    const __m512i gather =
+        _mm512_broadcast_i32x4(_mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        // 16 R | 16 G | 16 B | 16 A
+        __m512i px = _mm512_permutexvar_epi32(order, _mm512_shuffle_epi8(_mm512_loadu_si512(rgba + i * 4), gather));
+        __m256i alpha = _mm256_cvtepu8_epi16(_mm512_extracti32x4_epi32(px, 3));
+        __m256i red = _mm256_cvtepu8_epi16(_mm512_castsi512_si128(px));
+        __m256i green = _mm256_cvtepu8_epi16(_mm512_extracti32x4_epi32(px, 1));
+        __m256i blue = _mm256_cvtepu8_epi16(_mm512_extracti32x4_epi32(px, 2));
+        _mm256_storeu_si256((__m256i *)(planes + i), _mm256_mullo_epi16(red, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + stride + i), _mm256_mullo_epi16(green, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + 2 * stride + i), _mm256_mullo_epi16(blue, alpha));
+        _mm256_storeu_si256((__m256i *)(planes + 3 * stride + i), alpha);
+    }
+    _mm256_zeroupper();
+    premultiply_rgba_avx2(rgba + i * 4, planes + i, stride, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void accumulate_u16_avx512(uint32_t *sums, const uint16_t *row,
+                                                                             size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i samples = _mm512_loadu_si512(row + i);
+        __m512i low = _mm512_add_epi32(_mm512_loadu_si512(sums + i),
+                                       _mm512_cvtepu16_epi32(_mm512_castsi512_si256(samples)));
+        __m512i high = _mm512_add_epi32(_mm512_loadu_si512(sums + i + 16),
+                                        _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(samples, 1)));
+        _mm512_storeu_si512(sums + i, low);
+        _mm512_storeu_si512(sums + i + 16, high);
+    }
+    _mm256_zeroupper();
+    accumulate_u16_avx2(sums + i, row + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i ycc_fraction_avx512(__m512i low, __m512i high,
+                                                                                      __m512i weights)
+{
+    const __m512i half = _mm512_set1_epi32(32768);
+    low = _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(low, weights), half), 16);
+    high = _mm512_srai_epi32(_mm512_add_epi32(_mm512_madd_epi16(high, weights), half), 16);
+    return _mm512_packs_epi32(low, high);
+}
+
+// Clamped to bytes: negatives to zero, then VPMOVUSWB saturates the rest
+__attribute__((target("avx512f,avx512bw"))) static inline __m256i pack_u8_avx512(__m512i v)
+{
+    return _mm512_cvtusepi16_epi8(_mm512_max_epi16(v, _mm512_setzero_si512()));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void ycc_to_rgb_avx512(const unsigned char *y,
+                                                                         const unsigned char *cb,
+                                                                         const unsigned char *cr, unsigned char *rgb,
+                                                                         int n)
+{
+    const __m512i center = _mm512_set1_epi16(128);
+    const __m512i red_weights = _mm512_set1_epi32(26345 << 16);
+    const __m512i green_weights = _mm512_set1_epi32((18734 << 16) | (uint16_t)-22554);
+    const __m512i blue_weights = _mm512_set1_epi32((uint16_t)-14942);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i luma = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(y + i)));
+        __m512i chroma_blue = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(cb + i)));
+        __m512i chroma_red = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(cr + i)));
+        __m512i blue_diff = _mm512_sub_epi16(chroma_blue, center), red_diff = _mm512_sub_epi16(chroma_red, center);
+        __m512i low = _mm512_unpacklo_epi16(blue_diff, red_diff), high = _mm512_unpackhi_epi16(blue_diff, red_diff);
+        __m256i red = pack_u8_avx512(
+            _mm512_add_epi16(_mm512_add_epi16(luma, red_diff), ycc_fraction_avx512(low, high, red_weights)));
+        __m256i green = pack_u8_avx512(
+            _mm512_add_epi16(_mm512_sub_epi16(luma, red_diff), ycc_fraction_avx512(low, high, green_weights)));
+        __m256i blue = pack_u8_avx512(_mm512_add_epi16(_mm512_add_epi16(luma, _mm512_add_epi16(blue_diff, blue_diff)),
+                                                       ycc_fraction_avx512(low, high, blue_weights)));
+        interleave_rgb_sse41(_mm256_castsi256_si128(red), _mm256_castsi256_si128(green), _mm256_castsi256_si128(blue),
+                             rgb + i * 3);
+        interleave_rgb_sse41(_mm256_extracti128_si256(red, 1), _mm256_extracti128_si256(green, 1),
+                             _mm256_extracti128_si256(blue, 1), rgb + i * 3 + 48);
+    }
+    _mm256_zeroupper();
+    ycc_to_rgb_avx2(y + i, cb + i, cr + i, rgb + i * 3, n - i);
+}
+
+// Comparisons give masks here: counts and blends take them directly
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i cube_index_avx512(__m512i v)
+{
+    const __m512i one = _mm512_set1_epi16(1);
+    __m512i count = _mm512_maskz_mov_epi16(_mm512_cmpgt_epi16_mask(v, _mm512_set1_epi16(47)), one);
+    count = _mm512_mask_add_epi16(count, _mm512_cmpgt_epi16_mask(v, _mm512_set1_epi16(114)), count, one);
+    count = _mm512_mask_add_epi16(count, _mm512_cmpgt_epi16_mask(v, _mm512_set1_epi16(154)), count, one);
+    count = _mm512_mask_add_epi16(count, _mm512_cmpgt_epi16_mask(v, _mm512_set1_epi16(194)), count, one);
+    return _mm512_mask_add_epi16(count, _mm512_cmpgt_epi16_mask(v, _mm512_set1_epi16(234)), count, one);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i cube_distance_avx512(__m512i v, __m512i index)
+{
+    __m512i level = _mm512_maskz_add_epi16(_mm512_test_epi16_mask(index, index),
+                                           _mm512_mullo_epi16(index, _mm512_set1_epi16(40)), _mm512_set1_epi16(55));
+    __m512i diff = _mm512_sub_epi16(v, level);
+    return _mm512_mullo_epi16(diff, diff);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i quantize_avx512(__m512i r, __m512i g, __m512i b,
+                                                                                  const __m512i *dither)
+{
+    const __m512i zero = _mm512_setzero_si512(), max = _mm512_set1_epi16(255);
+    if (dither)
+    {
+        r = _mm512_min_epi16(_mm512_max_epi16(_mm512_add_epi16(r, *dither), zero), max);
+        g = _mm512_min_epi16(_mm512_max_epi16(_mm512_add_epi16(g, *dither), zero), max);
+        b = _mm512_min_epi16(_mm512_max_epi16(_mm512_add_epi16(b, *dither), zero), max);
+    }
+    __m512i ri = cube_index_avx512(r), gi = cube_index_avx512(g), bi = cube_index_avx512(b);
+    __m512i cube = _mm512_add_epi16(
+        _mm512_add_epi16(_mm512_mullo_epi16(ri, _mm512_set1_epi16(36)), _mm512_mullo_epi16(gi, _mm512_set1_epi16(6))),
+        _mm512_add_epi16(bi, _mm512_set1_epi16(16)));
+    if (dither)
+        return cube;
+
+    __m512i cube_distance = _mm512_add_epi16(
+        _mm512_add_epi16(cube_distance_avx512(r, ri), cube_distance_avx512(g, gi)), cube_distance_avx512(b, bi));
+    __m512i average = _mm512_mulhi_epu16(_mm512_add_epi16(_mm512_add_epi16(r, g), b), _mm512_set1_epi16(21846));
+    __m512i step = _mm512_min_epi16(
+        _mm512_mulhi_epu16(_mm512_subs_epu16(average, _mm512_set1_epi16(3)), _mm512_set1_epi16(6554)),
+        _mm512_set1_epi16(23));
+    __m512i level = _mm512_add_epi16(_mm512_mullo_epi16(step, _mm512_set1_epi16(10)), _mm512_set1_epi16(8));
+    __m512i dr = _mm512_sub_epi16(r, level), dg = _mm512_sub_epi16(g, level), db = _mm512_sub_epi16(b, level);
+    __m512i gray_distance = _mm512_add_epi16(
+        _mm512_add_epi16(_mm512_mullo_epi16(dr, dr), _mm512_mullo_epi16(dg, dg)), _mm512_mullo_epi16(db, db));
+    return _mm512_mask_blend_epi16(_mm512_cmpgt_epu16_mask(cube_distance, gray_distance), cube,
+                                   _mm512_add_epi16(step, _mm512_set1_epi16(232)));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void quantize_256_avx512(const unsigned char *pixels, int channels,
+                                                                           const signed char *dither,
+                                                                           unsigned char *indices, int n)
+{
+    int i = 0;
+    if (channels == 3)
+    {
+        __m512i offsets = _mm512_broadcast_i32x4(dither_offsets_sse41(dither));
+        for (; i + 32 <= n; i += 32)
+        {
+            __m128i r[2], g[2], b[2];
+            deinterleave_rgb_sse41(pixels + i * 3, &r[0], &g[0], &b[0]);
+            deinterleave_rgb_sse41(pixels + i * 3 + 48, &r[1], &g[1], &b[1]);
+            __m512i v = quantize_avx512(_mm512_cvtepu8_epi16(_mm256_set_m128i(r[1], r[0])),
+                                        _mm512_cvtepu8_epi16(_mm256_set_m128i(g[1], g[0])),
+                                        _mm512_cvtepu8_epi16(_mm256_set_m128i(b[1], b[0])), dither ? &offsets : NULL);
+            _mm256_storeu_si256((__m256i *)(indices + i), _mm512_cvtepi16_epi8(v));
+        }
+        _mm256_zeroupper();
+    }
+    quantize_256_avx2(pixels + i * channels, channels, dither, indices + i, n - i);
+}
+#endif
+
+#ifdef KERNELS_NEON
+// -------------------------------------------------------------
+// NEON: widening multiply-accumulate. 16-bit samples are widened
+// to 32 bits first, since VMLAL only takes signed halves.
+// -------------------------------------------------------------
+static int32_t dot_u8_neon(const int16_t *w, const unsigned char *p, int n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t samples = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + i)));
+        int16x8_t weights = vld1q_s16(w + i);
+        acc = vmlal_s16(acc, vget_low_s16(weights), vget_low_s16(samples));
+        acc = vmlal_high_s16(acc, weights, samples);
+    }
+    return vaddvq_s32(acc) + dot_u8_scalar(w + i, p + i, n - i);
+}
+
+static int32_t dot_u16_neon(const int16_t *w, const uint16_t *p, int n)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t samples = vld1q_u16(p + i);
+        int16x8_t weights = vld1q_s16(w + i);
+        acc = vmlaq_s32(acc, vmovl_s16(vget_low_s16(weights)), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(samples))));
+        acc = vmlaq_s32(acc, vmovl_high_s16(weights), vreinterpretq_s32_u32(vmovl_high_u16(samples)));
+    }
+    return vaddvq_s32(acc) + dot_u16_scalar(w + i, p + i, n - i);
+}
+
+static uint32_t sum_u16_neon(const uint16_t *p, int n)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        acc = vpadalq_u16(acc, vld1q_u16(p + i));
+    return vaddvq_u32(acc) + sum_u16_scalar(p + i, n - i);
+}
+
+static void premultiply_rgba_neon(const unsigned char *rgba, uint16_t *planes, int stride, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint8x8x4_t px = vld4_u8(rgba + i * 4); // Deinterleaves as it loads
+        vst1q_u16(planes + i, vmull_u8(px.val[0], px.val[3]));
+        vst1q_u16(planes + stride + i, vmull_u8(px.val[1], px.val[3]));
+        vst1q_u16(planes + 2 * stride + i, vmull_u8(px.val[2], px.val[3]));
+        vst1q_u16(planes + 3 * stride + i, vmovl_u8(px.val[3]));
+    }
+    premultiply_rgba_scalar(rgba + i * 4, planes + i, stride, n - i);
+}
+
+static void accumulate_u16_neon(uint32_t *sums, const uint16_t *row, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t samples = vld1q_u16(row + i);
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(samples)));
+        vst1q_u32(sums + i + 4, vaddw_high_u16(vld1q_u32(sums + i + 4), samples));
+    }
+    accumulate_u16_scalar(sums + i, row + i, n - i);
+}
+
+// The same split as on x86, with widening multiply-accumulates for the
+// fractions; VST3 interleaves as it stores
+static int16x8_t ycc_fraction_neon(int16x8_t blue_diff, int16x8_t red_diff, int16_t blue, int16_t red)
+{
+    const int32x4_t half = vdupq_n_s32(32768);
+    int32x4_t low = vmlal_n_s16(vmlal_n_s16(half, vget_low_s16(blue_diff), blue), vget_low_s16(red_diff), red);
+    int32x4_t high = vmlal_high_n_s16(vmlal_high_n_s16(half, blue_diff, blue), red_diff, red);
+    return vcombine_s16(vshrn_n_s32(low, 16), vshrn_n_s32(high, 16));
+}
+
+static uint8x8_t ycc_clamp_neon(int16x8_t base, int16x8_t fraction)
+{
+    return vqmovun_s16(vaddq_s16(base, fraction));
+}
+
+static void ycc_to_rgb_neon(const unsigned char *y, const unsigned char *cb, const unsigned char *cr,
+                            unsigned char *rgb, int n)
+{
+    const uint8x8_t center = vdup_n_u8(128);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16_t luma8 = vld1q_u8(y + i), blue8 = vld1q_u8(cb + i), red8 = vld1q_u8(cr + i);
+        uint8x8_t red[2], green[2], blue[2];
+        for (int h = 0; h < 2; h++)
+        {
+            uint8x8_t luma_half = h ? vget_high_u8(luma8) : vget_low_u8(luma8);
+            int16x8_t luma = vreinterpretq_s16_u16(vmovl_u8(luma_half));
+            int16x8_t blue_diff = vreinterpretq_s16_u16(vsubl_u8(h ? vget_high_u8(blue8) : vget_low_u8(blue8), center));
+            int16x8_t red_diff = vreinterpretq_s16_u16(vsubl_u8(h ? vget_high_u8(red8) : vget_low_u8(red8), center));
+            red[h] = ycc_clamp_neon(vaddq_s16(luma, red_diff), ycc_fraction_neon(blue_diff, red_diff, 0, 26345));
+            green[h] = ycc_clamp_neon(vsubq_s16(luma, red_diff),
+                                        ycc_fraction_neon(blue_diff, red_diff, -22554, 18734));
+            blue[h] = ycc_clamp_neon(vaddq_s16(luma, vshlq_n_s16(blue_diff, 1)),
+                                       ycc_fraction_neon(blue_diff, red_diff, -14942, 0));
+        }
+        uint8x16x3_t px = {
+            {vcombine_u8(red[0], red[1]), vcombine_u8(green[0], green[1]), vcombine_u8(blue[0], blue[1])}};
+        vst3q_u8(rgb + i * 3, px);
+    }
+    ycc_to_rgb_scalar(y + i, cb + i, cr + i, rgb + i * 3, n - i);
+}
+
+static int16x8_t cube_index_neon(int16x8_t v)
+{
+    int16x8_t count = vreinterpretq_s16_u16(vcgtq_s16(v, vdupq_n_s16(47)));
+    count = vaddq_s16(count, vreinterpretq_s16_u16(vcgtq_s16(v, vdupq_n_s16(114))));
+    count = vaddq_s16(count, vreinterpretq_s16_u16(vcgtq_s16(v, vdupq_n_s16(154))));
+    count = vaddq_s16(count, vreinterpretq_s16_u16(vcgtq_s16(v, vdupq_n_s16(194))));
+    count = vaddq_s16(count, vreinterpretq_s16_u16(vcgtq_s16(v, vdupq_n_s16(234))));
+    return vnegq_s16(count);
+}
+
+static uint16x8_t cube_distance_neon(int16x8_t v, int16x8_t index)
+{
+    int16x8_t level = vmlaq_n_s16(vdupq_n_s16(55), index, 40);
+    int16x8_t diff = vsubq_s16(v, vandq_s16(level, vreinterpretq_s16_u16(vcgtzq_s16(index))));
+    return vreinterpretq_u16_s16(vmulq_s16(diff, diff));
+}
+
+// Squares wrap in signed lanes, but read back unsigned they are exact
+static uint16x8_t quantize_neon(uint8x8_t r8, uint8x8_t g8, uint8x8_t b8, const int16x8_t *dither)
+{
+    int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(r8));
+    int16x8_t g = vreinterpretq_s16_u16(vmovl_u8(g8));
+    int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(b8));
+    if (dither)
+    {
+        const int16x8_t zero = vdupq_n_s16(0), max = vdupq_n_s16(255);
+        r = vminq_s16(vmaxq_s16(vaddq_s16(r, *dither), zero), max);
+        g = vminq_s16(vmaxq_s16(vaddq_s16(g, *dither), zero), max);
+        b = vminq_s16(vmaxq_s16(vaddq_s16(b, *dither), zero), max);
+    }
+    int16x8_t ri = cube_index_neon(r), gi = cube_index_neon(g), bi = cube_index_neon(b);
+    uint16x8_t cube = vreinterpretq_u16_s16(vmlaq_n_s16(vmlaq_n_s16(vaddq_s16(bi, vdupq_n_s16(16)), gi, 6), ri, 36));
+    if (dither)
+        return cube;
+
+    uint16x8_t cube_distance =
+        vaddq_u16(vaddq_u16(cube_distance_neon(r, ri), cube_distance_neon(g, gi)), cube_distance_neon(b, bi));
+    uint16x8_t sum = vreinterpretq_u16_s16(vaddq_s16(vaddq_s16(r, g), b));
+    uint16x8_t average = vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(sum), 21846), 16),
+                                      vshrn_n_u32(vmull_high_n_u16(sum, 21846), 16));
+    uint16x8_t above = vqsubq_u16(average, vdupq_n_u16(3));
+    uint16x8_t step = vminq_u16(vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(above), 6554), 16),
+                                             vshrn_n_u32(vmull_high_n_u16(above, 6554), 16)),
+                                vdupq_n_u16(23));
+    int16x8_t level = vreinterpretq_s16_u16(vmlaq_n_u16(vdupq_n_u16(8), step, 10));
+    int16x8_t dr = vsubq_s16(r, level), dg = vsubq_s16(g, level), db = vsubq_s16(b, level);
+    uint16x8_t gray_distance = vreinterpretq_u16_s16(vmlaq_s16(vmlaq_s16(vmulq_s16(dr, dr), dg, dg), db, db));
+    return vbslq_u16(vcgtq_u16(cube_distance, gray_distance), vaddq_u16(step, vdupq_n_u16(232)), cube);
+}
+
+static void quantize_256_neon(const unsigned char *pixels, int channels, const signed char *dither,
+                              unsigned char *indices, int n)
+{
+    int i = 0;
+    if (channels == 3)
+    {
+        int16x8_t offsets = vdupq_n_s16(0);
+        if (dither)
+        {
+            const int16_t pattern[8] = {dither[0], dither[1], dither[2], dither[3],
+                                        dither[0], dither[1], dither[2], dither[3]};
+            offsets = vld1q_s16(pattern);
+        }
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16x3_t px = vld3q_u8(pixels + i * 3); // Deinterleaves as it loads
+            uint16x8_t low = quantize_neon(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]), vget_low_u8(px.val[2]),
+                                           dither ? &offsets : NULL);
+            uint16x8_t high = quantize_neon(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]), vget_high_u8(px.val[2]),
+                                            dither ? &offsets : NULL);
+            vst1q_u8(indices + i, vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+        }
+    }
+    quantize_256_scalar(pixels + i * channels, channels, dither, indices + i, n - i);
+}
+#endif
+
+// -------------------------------------------------------------
+// Dispatch: variants from best to worst, each with a check that
+// the CPU (and the OS, for wider registers) supports it
+// -------------------------------------------------------------
+typedef struct {
+    PixelKernels kernels;
+    int (*supported)(void);
+} Variant;
+
+static int always(void)
+{
+    return 1;
+}
+
+#ifdef KERNELS_X86
+static int has_sse41(void)
+{
+    return __builtin_cpu_supports("sse4.1");
+}
+
+static int has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static int has_avx512(void)
+{
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+static const Variant variants[] = {
+#ifdef KERNELS_X86
+    {{"avx512", dot_u8_avx512, dot_u16_avx512, sum_u16_avx512, premultiply_rgba_avx512, accumulate_u16_avx512,
+      ycc_to_rgb_avx512, quantize_256_avx512},
+     has_avx512},
+    {{"avx2", dot_u8_avx2, dot_u16_avx2, sum_u16_avx2, premultiply_rgba_avx2, accumulate_u16_avx2, ycc_to_rgb_avx2,
+      quantize_256_avx2},
+     has_avx2},
+    {{"sse4.1", dot_u8_sse41, dot_u16_sse41, sum_u16_sse41, premultiply_rgba_sse41, accumulate_u16_sse41,
+      ycc_to_rgb_sse41, quantize_256_sse41},
+     has_sse41},
+#endif
+#ifdef KERNELS_NEON
+    {{"neon", dot_u8_neon, dot_u16_neon, sum_u16_neon, premultiply_rgba_neon, accumulate_u16_neon, ycc_to_rgb_neon,
+      quantize_256_neon},
+     always},
+#endif
+    {{"scalar", dot_u8_scalar, dot_u16_scalar, sum_u16_scalar, premultiply_rgba_scalar, accumulate_u16_scalar,
+      ycc_to_rgb_scalar, quantize_256_scalar},
+     always},
+};
+
+#define VARIANTS (int)(sizeof(variants) / sizeof(variants[0]))
+
+static const PixelKernels *selected;
+
+int pixel_kernels_select(const char *name)
+{
+    int automatic = name == NULL || strcmp(name, "auto") == 0;
+    for (int i = 0; i < VARIANTS; i++)
+    {
+        if ((automatic || strcmp(name, variants[i].kernels.name) == 0) && variants[i].supported())
+        {
+            __atomic_store_n(&selected, &variants[i].kernels, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const PixelKernels *pixel_kernels(void)
+{
+    const PixelKernels *kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernels == NULL)
+    {
+        pixel_kernels_select(NULL);
+        kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    }
+    return kernels;
+}
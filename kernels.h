@@ -0,0 +1,41 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The per-pixel loops of the resampler, the JPEG color conversion and
+// the 256-color quantizer, in one variant per instruction set. The best
+// one the CPU supports is picked once, on first use or by
+// pixel_kernels_select(); all variants give bit-identical results.
+typedef struct {
+    const char *name;
+    // Sum of n bytes times n 2.14 weights. The weighted sum must fit in
+    // 32 bits, which any normalized filter over bytes does.
+    int32_t (*dot_u8)(const int16_t *w, const unsigned char *p, int n);
+    // The same over 16-bit samples (linear light), where a normalized
+    // filter with positive lobes under 2 still fits
+    int32_t (*dot_u16)(const int16_t *w, const uint16_t *p, int n);
+    // Sum of n 16-bit samples; n up to 65536 can't overflow
+    uint32_t (*sum_u16)(const uint16_t *p, int n);
+    // Split n RGBA pixels into four planes, stride samples apart: each
+    // color times alpha (exact, up to 255 * 255), then alpha itself
+    void (*premultiply_rgba)(const unsigned char *rgba, uint16_t *planes, int stride, int n);
+    // Add a row of n 16-bit samples into 32-bit column sums
+    void (*accumulate_u16)(uint32_t *sums, const uint16_t *row, size_t n);
+    // JFIF YCbCr planes to n interleaved RGB pixels, in 16.16 fixed point
+    void (*ycc_to_rgb)(const unsigned char *y, const unsigned char *cb, const unsigned char *cr, unsigned char *rgb,
+                       int n);
+    // xterm 256-color indices of n pixels, channels bytes apart (gray if
+    // one): the nearest of the 6x6x6 cube and the gray ramp, or with
+    // dither, the cube color of each channel plus dither[i % 4]
+    void (*quantize_256)(const unsigned char *pixels, int channels, const signed char *dither, unsigned char *indices,
+                         int n);
+} PixelKernels;
+
+const PixelKernels *pixel_kernels(void);
+// "auto" or one variant by name: scalar, sse4.1, avx2, avx512, neon.
+// Fails for names this build or this CPU doesn't have.
+int pixel_kernels_select(const char *name);
+
+#endif
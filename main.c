@@ -1,11 +1,15 @@
-#include "png_handler.h"
+#include "kernels.h"
+#include "pool.h"
+#include "render.h"
+#include "stats.h"
+#include "trace.h"
+#include "vishellize.h"
 #include <string.h>
 #include <locale.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <turbojpeg.h>
 
 // -------------------------------------------------------------
 // Helper: Print help menu
@@ -14,22 +18,27 @@ static void print_help()
 {
     printf("Usage:\n"
            "  vishellize [file] [...]\n"
-           "  vishellize [-v | --verbose] [file] [...] -- Display debug logs.\n"
+           "  vishellize [-v | --verbose] [file] [...] -- Display debug logs (on stderr).\n"
+           "  vishellize [--stats | --stats-json] [file] [...] -- Report time, bytes and memory per stage on stderr.\n"
+           "  vishellize [--stats-file <path>] [file] [...] -- Write the stats report there instead.\n"
+           "  vishellize [--trace <path>] [file] [...] -- Record a timeline in Chrome trace format (for Perfetto).\n"
+           "  vishellize [--cpu auto|scalar|sse4.1|avx2|avx512|neon] [file] [...] -- Pick the pixel kernels (default: auto).\n"
+           "  vishellize [-w | --width <columns>] [file] [...] -- Output width (default: fit terminal).\n"
+           "  vishellize [--crop <w>x<h>+<x>+<y>] [file] [...] -- Render only part of the image.\n"
+           "  vishellize [--max-memory <MiB>] [file] [...] -- Decode in bands to stay within a memory budget.\n"
+           "  vishellize [--quality fast|balanced|best] [file] [...] -- Trade quality for speed (default: balanced).\n"
+           "  vishellize [--colors 256|truecolor] [file] [...] -- Override the preset's color depth.\n"
+           "  vishellize [--linear] [file] [...] -- Downscale in linear light, keeping fine detail bright.\n"
+           "  vishellize [--bg <#rrggbb>] [file] [...] -- Blend transparency into this color (default: ask the terminal).\n"
+           "  vishellize [--cell-size <w>x<h>] [file] [...] -- Cell size in pixels, for the aspect ratio (default: ask the terminal).\n"
+           "  vishellize [--sparse <tolerance>|off] [file] [...] -- Skip cells this close to the background (default: 3 if known).\n"
+           "  vishellize [-p | --preview] [file] [...] -- Show a 1/8-scale JPEG preview first, then refine it.\n"
+           "  vishellize [--progressive] [file] [...] -- Redraw progressive JPEGs and interlaced PNGs as they refine.\n"
+           "  vishellize [--time-budget <ms>] [file] [...] -- Stop refining at the last scan or pass done in time.\n"
+           "  vishellize [--save <path.vzc>] [file] [...] -- Save the cell grid for replay instead of drawing it.\n"
            "  vishellize [-h | --help] [...] -- Shows this help page.\n");
 }
 
-// -------------------------------------------------------------
-// Helper: Get file size
-// -------------------------------------------------------------
-static size_t get_file_size(FILE *file)
-{
-    long current_position = ftell(file);
-    fseek(file, 0, SEEK_END);
-    unsigned long length = ftell(file);
-    fseek(file, current_position, SEEK_SET);
-    return length;
-}
-
 // -------------------------------------------------------------
 // Verbose logging
 // -------------------------------------------------------------
@@ -42,109 +51,36 @@ static int verbose(const char *restrict format, ...)
 
     va_list args;
     va_start(args, format);
-    int ret = vprintf(format, args);
+    int ret = vfprintf(stderr, format, args);
     va_end(args);
     return ret;
 }
 
 // -------------------------------------------------------------
-// JPEG Processing Function
+// Helper: Parse a crop geometry such as 640x480+100+50
 // -------------------------------------------------------------
-static int process_jpeg(FILE *file)
+static bool parse_region(const char *text, VishellizeRegion *region)
 {
-    size_t jpeg_size = get_file_size(file);
-    verbose("File size: %ld\n", jpeg_size);
-
-    unsigned char *jpeg_buffer = malloc(jpeg_size);
-    if (jpeg_buffer == NULL)
-    {
-        fprintf(stderr, "Couldn't allocate memory for file.\n");
-        return 1;
-    }
-
-    const size_t bytes_read = fread(jpeg_buffer, 1, jpeg_size, file);
-    verbose("Read %d bytes into buffer.\n", bytes_read);
-
-    if (bytes_read != jpeg_size)
-    {
-        fprintf(stderr, "Couldn't load file contents into memory.\n");
-        free(jpeg_buffer);
-        return 1;
-    }
-
-    tjhandle tj = tj3Init(TJINIT_DECOMPRESS);
-    if (tj == NULL)
-    {
-        fprintf(stderr, "Couldn't create TurboJPEG instance: %s.\n", tj3GetErrorStr(tj));
-        free(jpeg_buffer);
-        return 1;
-    }
-
-    if (tj3DecompressHeader(tj, jpeg_buffer, jpeg_size) < 0)
-    {
-        fprintf(stderr, "Couldn't decompress JPEG header: %s.\n", tj3GetErrorStr(tj));
-        tj3Destroy(tj);
-        free(jpeg_buffer);
-        return 1;
-    }
-
-    int width = tj3Get(tj, TJPARAM_JPEGWIDTH);
-    int height = tj3Get(tj, TJPARAM_JPEGHEIGHT);
-    verbose("Image dimensions (px): %dx%d\n", width, height);
-
-    unsigned char *rgb_buffer = malloc(3 * width * height);
-    if (rgb_buffer == NULL)
-    {
-        fprintf(stderr, "Couldn't allocate memory for RGB buffer.\n");
-        tj3Destroy(tj);
-        free(jpeg_buffer);
-        return 1;
-    }
-
-    if (tj3Decompress8(tj, jpeg_buffer, jpeg_size, rgb_buffer, 0, TJPF_RGB))
-    {
-        fprintf(stderr, "Couldn't decompress image into RGB buffer: %s.\n", tj3GetErrorStr(tj));
-        free(rgb_buffer);
-        tj3Destroy(tj);
-        free(jpeg_buffer);
-        return 1;
-    }
-
-    // Render JPEG
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            int pixel_index = 3 * (width * y + x);
-            unsigned char r = rgb_buffer[pixel_index];
-            unsigned char g = rgb_buffer[pixel_index + 1];
-            unsigned char b = rgb_buffer[pixel_index + 2];
-            printf("\x1b[38;2;%d;%d;%dm█", r, g, b);
-        }
-        printf("\n");
-    }
-
-    printf("\033[0m"); // Reset ANSI colors
-
-    free(rgb_buffer);
-    tj3Destroy(tj);
-    free(jpeg_buffer);
-
-    return 0;
+    char trailing;
+    return sscanf(text, "%dx%d+%d+%d%c", &region->width, &region->height, &region->x, &region->y, &trailing) == 4 &&
+           region->width > 0 && region->height > 0 && region->x >= 0 && region->y >= 0;
 }
 
 // -------------------------------------------------------------
-// Helper: Check if string ends with suffix
+// Helper: Parse a color like "#1e1e2e" (the '#' is optional)
 // -------------------------------------------------------------
-int ends_with(const char *str, const char *suffix)
+static bool parse_color(const char *text, unsigned char *rgb)
 {
-    if (!str || !suffix)
-        return 0;
-    size_t lenstr = strlen(str);
-    size_t lensuffix = strlen(suffix);
-    if (lensuffix > lenstr)
-        return 0;
-    return strncmp(str + lenstr - lensuffix, suffix, lensuffix) == 0;
+    unsigned int r, g, b;
+    int length = 0;
+    if (*text == '#')
+        text++;
+    if (sscanf(text, "%2x%2x%2x%n", &r, &g, &b, &length) != 3 || length != 6 || text[length] != '\0')
+        return false;
+    rgb[0] = (unsigned char)r;
+    rgb[1] = (unsigned char)g;
+    rgb[2] = (unsigned char)b;
+    return true;
 }
 
 // -------------------------------------------------------------
@@ -153,6 +89,16 @@ int ends_with(const char *str, const char *suffix)
 int main(int argc, char const *argv[])
 {
     FILE *file = stdin;
+    VishellizeOptions options = {0};
+    bool preview_mode = false;
+    bool progressive_mode = false;
+    bool background_given = false;
+    int sparse = -1; // --sparse: 1 = on, 0 = off, -1 = when the background is known
+    int tolerance = 3;
+    enum { STATS_MODE_OFF, STATS_MODE_TEXT, STATS_MODE_JSON } stats_mode = STATS_MODE_OFF;
+    const char *stats_path = NULL; // NULL = stderr
+    const char *trace_path = NULL;
+    const char *save_path = NULL;
 
     // Command line parsing
     for (int i = 1; i < argc; i++)
@@ -171,6 +117,195 @@ int main(int argc, char const *argv[])
             continue;
         }
 
+        if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats-json") == 0)
+        {
+            stats_mode = strcmp(arg, "--stats-json") == 0 ? STATS_MODE_JSON : STATS_MODE_TEXT;
+            continue;
+        }
+
+        if (strcmp(arg, "--stats-file") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Flag '%s' expects a file path.\n", arg);
+                return EXIT_FAILURE;
+            }
+            stats_path = argv[++i];
+            if (stats_mode == STATS_MODE_OFF)
+                stats_mode = STATS_MODE_TEXT;
+            continue;
+        }
+
+        if (strcmp(arg, "--trace") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Flag '%s' expects a file path.\n", arg);
+                return EXIT_FAILURE;
+            }
+            trace_path = argv[++i];
+            continue;
+        }
+
+        if (strcmp(arg, "--save") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Flag '%s' expects a file path.\n", arg);
+                return EXIT_FAILURE;
+            }
+            save_path = argv[++i];
+            options.output = VISHELLIZE_CELLS;
+            continue;
+        }
+
+        if (strcmp(arg, "--cpu") == 0)
+        {
+            if (i + 1 >= argc || pixel_kernels_select(argv[++i]))
+            {
+                fprintf(stderr, "Flag '%s' expects auto or a variant this CPU supports.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "-p") == 0 || strcmp(arg, "--preview") == 0)
+        {
+            preview_mode = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--progressive") == 0)
+        {
+            progressive_mode = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--time-budget") == 0)
+        {
+            if (i + 1 >= argc || (options.time_budget_ms = atoi(argv[++i])) <= 0)
+            {
+                fprintf(stderr, "Flag '%s' expects a positive number of milliseconds.\n", arg);
+                return EXIT_FAILURE;
+            }
+            progressive_mode = true;
+            continue;
+        }
+
+        if (strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0)
+        {
+            if (i + 1 >= argc || (options.width = atoi(argv[++i])) <= 0)
+            {
+                fprintf(stderr, "Flag '%s' expects a positive number of columns.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--crop") == 0)
+        {
+            if (i + 1 >= argc || !parse_region(argv[++i], &options.crop))
+            {
+                fprintf(stderr, "Flag '%s' expects a region like 640x480+0+0.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--max-memory") == 0)
+        {
+            int mebibytes;
+            if (i + 1 >= argc || (mebibytes = atoi(argv[++i])) <= 0)
+            {
+                fprintf(stderr, "Flag '%s' expects a positive number of MiB.\n", arg);
+                return EXIT_FAILURE;
+            }
+            options.max_memory = (size_t)mebibytes << 20;
+            continue;
+        }
+
+        if (strcmp(arg, "--quality") == 0)
+        {
+            const char *preset = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(preset, "fast") == 0)
+                options.quality = VISHELLIZE_FAST;
+            else if (strcmp(preset, "balanced") == 0)
+                options.quality = VISHELLIZE_BALANCED;
+            else if (strcmp(preset, "best") == 0)
+                options.quality = VISHELLIZE_BEST;
+            else
+            {
+                fprintf(stderr, "Flag '%s' expects fast, balanced or best.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--bg") == 0)
+        {
+            if (i + 1 >= argc || !parse_color(argv[++i], options.background))
+            {
+                fprintf(stderr, "Flag '%s' expects a color like #1e1e2e.\n", arg);
+                return EXIT_FAILURE;
+            }
+            background_given = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--cell-size") == 0)
+        {
+            char trailing;
+            if (i + 1 >= argc ||
+                sscanf(argv[++i], "%dx%d%c", &options.cell_width, &options.cell_height, &trailing) != 2 ||
+                options.cell_width <= 0 || options.cell_height <= 0)
+            {
+                fprintf(stderr, "Flag '%s' expects a cell size in pixels like 8x16.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--sparse") == 0)
+        {
+            const char *value = i + 1 < argc ? argv[++i] : "";
+            char *end;
+            long levels = strtol(value, &end, 10);
+            if (strcmp(value, "off") == 0)
+                sparse = 0;
+            else if (*value != '\0' && *end == '\0' && levels >= 0 && levels <= 255)
+            {
+                sparse = 1;
+                tolerance = (int)levels;
+            }
+            else
+            {
+                fprintf(stderr, "Flag '%s' expects a tolerance from 0 to 255, or off.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        if (strcmp(arg, "--linear") == 0)
+        {
+            options.linear = 1;
+            continue;
+        }
+
+        if (strcmp(arg, "--colors") == 0)
+        {
+            const char *depth = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(depth, "256") == 0)
+                options.colors = VISHELLIZE_256_COLORS;
+            else if (strcmp(depth, "truecolor") == 0)
+                options.colors = VISHELLIZE_TRUECOLOR;
+            else
+            {
+                fprintf(stderr, "Flag '%s' expects 256 or truecolor.\n", arg);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
         if (strlen(arg) > 1 && strncmp(arg, "-", 1) == 0)
         {
             fprintf(stderr, "Invalid flag '%s'.\n", arg);
@@ -186,49 +321,81 @@ int main(int argc, char const *argv[])
         break;
     }
 
-    setlocale(LC_CTYPE, "en_us.UTF8"); // Unicode handling
+    // Progressive refinement wins over a preview when both are asked for
+    options.refine = progressive_mode ? VISHELLIZE_PROGRESSIVE : preview_mode ? VISHELLIZE_PREVIEW : VISHELLIZE_ONCE;
 
-    // Detect file type by extension
-    const char *filename = argv[argc - 1];
+    if (stats_mode != STATS_MODE_OFF)
+        stats_start();
+    if (trace_path)
+        trace_start();
 
-    if (ends_with(filename, ".png"))
+    // Transparent pixels take the terminal's own background, black if it
+    // won't say; the cell shape is its own too, 1:2 if it won't say
+    if (!background_given || options.cell_height == 0)
     {
-        PNGImage img = load_png(filename);
-        if (!img.pixels)
+        TerminalInfo terminal;
+        terminal_query(&terminal, !background_given);
+        if (terminal.has_background)
         {
-            fprintf(stderr, "Failed to load PNG image.\n");
-            return EXIT_FAILURE;
+            memcpy(options.background, terminal.background, 3);
+            background_given = true;
         }
-
-        // Render PNG
-        for (int y = 0; y < img.height; y++)
+        if (options.cell_height == 0)
         {
-            unsigned char *row = img.pixels + y * img.width * 4; // 4 bytes per pixel (RGBA)
-            for (int x = 0; x < img.width; x++)
-            {
-                unsigned char *px = &row[x * 4];
-                unsigned char r = px[0];
-                unsigned char g = px[1];
-                unsigned char b = px[2];
-                printf("\x1b[38;2;%d;%d;%dm█", r, g, b);
-            }
-            printf("\x1b[0m\n");
+            options.cell_width = terminal.cell_width;
+            options.cell_height = terminal.cell_height;
         }
-
-        free(img.pixels);
     }
-    else if (ends_with(filename, ".jpg") || ends_with(filename, ".jpeg"))
+
+    // Skipped cells show the terminal's background, so only skip what
+    // is known to match it
+    options.sparse = sparse > 0 || (sparse < 0 && background_given);
+    options.tolerance = tolerance;
+
+    setlocale(LC_CTYPE, "en_us.UTF8"); // Unicode handling
+
+    Vishellize *context = vishellize_create();
+    if (context == NULL)
     {
-        process_jpeg(file);
+        fprintf(stderr, "Couldn't allocate memory for the renderer.\n");
+        return EXIT_FAILURE;
     }
-    else
+    if (verbose_mode)
+        vishellize_set_log(context, stderr);
+
+    verbose("Pixel kernels: %s\n", pixel_kernels()->name);
+
+    FILE *out = save_path ? fopen(save_path, "wb") : stdout;
+    if (out == NULL)
     {
-        fprintf(stderr, "Unsupported file format.\n");
+        fprintf(stderr, "Couldn't open '%s' for writing.\n", save_path);
+        vishellize_destroy(context);
         return EXIT_FAILURE;
     }
 
+    int status = vishellize_render_file(context, file, &options, out) == VISHELLIZE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    vishellize_destroy(context);
+    if (out != stdout && fclose(out) != 0)
+        status = EXIT_FAILURE;
+
+    if (stats_mode != STATS_MODE_OFF)
+    {
+        FILE *report = stats_path ? fopen(stats_path, "w") : stderr;
+        if (report == NULL)
+            fprintf(stderr, "Couldn't open '%s' for writing.\n", stats_path);
+        else
+        {
+            stats_report(report, stats_mode == STATS_MODE_JSON);
+            if (report != stderr)
+                fclose(report);
+        }
+    }
+    if (trace_path && trace_write(trace_path))
+        status = EXIT_FAILURE;
+    pool_trim();
+
     if (file != NULL && file != stdin)
         fclose(file);
 
-    return EXIT_SUCCESS;
+    return status;
 }
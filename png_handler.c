@@ -1,74 +1,456 @@
 #include <png.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "png_handler.h"
+#include "pool.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
 
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t offset;
+} PNGSource;
 
-PNGImage load_png(const char *filename) {
-    PNGImage img = {0};
+// libpng read callback: copy the next chunk straight out of the mapping
+static void read_from_memory(png_structp png_ptr, png_bytep out, png_size_t length) {
+    PNGSource *src = (PNGSource *)png_get_io_ptr(png_ptr);
+    if (length > src->size - src->offset)
+        png_error(png_ptr, "Read past end of PNG data");
+    memcpy(out, src->data + src->offset, length);
+    src->offset += length;
+}
+
+// Configure libpng to hand back RGBA whatever the source format: 8-bit,
+// or 16-bit when wide is set and the source has 16-bit samples
+static void set_rgba_transforms(png_structp png_ptr, png_infop info_ptr, int wide) {
+    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
+    png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+    // ---- FIXED: Force conversion to RGBA ----
+    if (bit_depth == 16 && !wide)
+        png_set_strip_16(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png_ptr);
+
+    // Always ensure we have 4 channels (RGBA)
+    if (!(color_type & PNG_COLOR_MASK_ALPHA))
+        png_set_filler(png_ptr, bit_depth == 16 && wide ? 0xFFFF : 0xFF, PNG_FILLER_AFTER);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+}
+
+// Configure libpng's output. Palette images keep their one-byte indices
+// when the sink can take them and opaque grayscale stays gray; everything
+// else becomes RGBA. 16-bit samples are kept, in host byte order, when
+// the sink takes wide rows, and stripped to 8 bits otherwise. Returns the
+// bytes per output pixel.
+static int set_transforms(png_structp png_ptr, png_infop info_ptr, const RowSink *sink) {
+    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
+    int wide = png_get_bit_depth(png_ptr, info_ptr) == 16 && sink->begin_wide;
+    const png_uint_16 one = 1;
+
+    if (wide && *(const unsigned char *)&one)
+        png_set_swap(png_ptr); // PNG stores 16-bit samples big-endian
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE && sink->begin_indexed) {
+        png_set_packing(png_ptr); // 1, 2 and 4-bit indices to a byte each
+        return 1;
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+        if (png_get_bit_depth(png_ptr, info_ptr) < 8)
+            png_set_expand_gray_1_2_4_to_8(png_ptr);
+        else if (!wide)
+            png_set_strip_16(png_ptr);
+        return wide ? 2 : 1;
+    }
+    set_rgba_transforms(png_ptr, info_ptr, wide);
+    return wide ? 8 : 4;
+}
+
+// Start the sink in the format set_transforms picked. After
+// png_read_update_info() the color type and bit depth describe the
+// output rows.
+static int begin_sink(png_structp png_ptr, png_infop info_ptr, RowSink *sink, const Region *region, int pixel_bytes) {
+    if (png_get_bit_depth(png_ptr, info_ptr) == 16)
+        return sink->begin_wide(sink->user, region->width, region->height, pixel_bytes / 2, 16);
+    if (png_get_color_type(png_ptr, info_ptr) != PNG_COLOR_TYPE_PALETTE)
+        return sink->begin(sink->user, region->width, region->height, pixel_bytes);
+
+    png_colorp plte = NULL;
+    int entries = 0;
+    png_bytep trans = NULL;
+    int trans_count = 0;
+    png_get_PLTE(png_ptr, info_ptr, &plte, &entries);
+    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_get_tRNS(png_ptr, info_ptr, &trans, &trans_count, NULL);
+
+    // Indices past the end of PLTE come out black, as libpng expands them
+    unsigned char palette[256 * 4] = { 0 };
+    for (int i = 0; i < entries && i < 256; i++) {
+        palette[i * 4 + 0] = plte[i].red;
+        palette[i * 4 + 1] = plte[i].green;
+        palette[i * 4 + 2] = plte[i].blue;
+        palette[i * 4 + 3] = i < trans_count ? trans[i] : 0xFF;
+    }
+
+    return sink->begin_indexed(sink->user, region->width, region->height, palette);
+}
+
+// Interlaced images have no row-at-a-time path, so the whole image must
+// fit the memory budget.
+static int interlaced_over_budget(const DecodeOptions *decode, size_t rowbytes, int height) {
+    size_t bytes = rowbytes * height;
+    if (!exceeds_budget(decode, bytes))
+        return 0;
+    fprintf(stderr, "Interlaced PNG needs %zu MiB of pixels, over the %zu MiB budget.\n",
+            bytes >> 20, decode->max_memory >> 20);
+    return 1;
+}
 
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        perror("Error opening PNG file");
-        return img;
+// Interlaced images only have complete rows after the last pass, so they
+// are decoded whole and then replayed into the sink.
+static void read_interlaced(png_structp png_ptr, size_t rowbytes, int height, const Region *region,
+                            int pixel_bytes, RowSink *sink, unsigned char *volatile *pixels) {
+    *pixels = (unsigned char *)pool_alloc(rowbytes * height);
+    png_bytep *row_pointers = (png_bytep *)pool_alloc(sizeof(png_bytep) * height);
+    if (!*pixels || !row_pointers) {
+        pool_free(row_pointers);
+        png_error(png_ptr, "Couldn't allocate memory for PNG pixels");
     }
 
-    unsigned char header[8];
-    fread(header, 1, 8, fp);
-    if (png_sig_cmp(header, 0, 8)) {
+    for (int y = 0; y < height; y++)
+        row_pointers[y] = *pixels + y * rowbytes;
+
+    uint64_t span = trace_begin();
+    png_read_image(png_ptr, row_pointers);
+    trace_end("png_read_image", span);
+    pool_free(row_pointers);
+
+    for (int y = region->y; y < region->y + region->height; y++)
+        sink->row(sink->user, *pixels + y * rowbytes + region->x * pixel_bytes);
+}
+
+int decode_png(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink) {
+    if (size < 8 || png_sig_cmp(data, 0, 8)) {
         fprintf(stderr, "Not a valid PNG file\n");
-        fclose(fp);
-        return img;
+        return 1;
     }
 
+    PNGSource src = { data, size, 8 };
+
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     png_infop info_ptr = png_create_info_struct(png_ptr);
 
+    // volatile: these are assigned after setjmp and freed on longjmp
+    unsigned char *volatile row = NULL;
+    unsigned char *volatile pixels = NULL;
+
     if (setjmp(png_jmpbuf(png_ptr))) {
         fprintf(stderr, "Error reading PNG\n");
-        fclose(fp);
-        return img;
+        pool_free(row);
+        pool_free(pixels);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
     }
 
-    png_init_io(png_ptr, fp);
+    png_set_read_fn(png_ptr, &src, read_from_memory);
     png_set_sig_bytes(png_ptr, 8);
     png_read_info(png_ptr, info_ptr);
 
-    img.width = png_get_image_width(png_ptr, info_ptr);
-    img.height = png_get_image_height(png_ptr, info_ptr);
-    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
-    png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    int width = png_get_image_width(png_ptr, info_ptr);
+    int height = png_get_image_height(png_ptr, info_ptr);
+    int passes = png_set_interlace_handling(png_ptr);
+    int pixel_bytes = set_transforms(png_ptr, info_ptr, sink);
+    png_read_update_info(png_ptr, info_ptr);
 
-    // ---- FIXED: Force conversion to RGBA ----
-    if (bit_depth == 16)
-        png_set_strip_16(png_ptr);
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_palette_to_rgb(png_ptr);
-    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
-        png_set_expand_gray_1_2_4_to_8(png_ptr);
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-        png_set_tRNS_to_alpha(png_ptr);
+    size_t rowbytes = png_get_rowbytes(png_ptr, info_ptr);
 
-    // Always ensure we have 4 channels (RGBA)
-    if (!(color_type & PNG_COLOR_MASK_ALPHA))
-        png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
-    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-        png_set_gray_to_rgb(png_ptr);
+    Region region = decode->crop;
+    if (region_clamp(&region, width, height)) {
+        fprintf(stderr, "Crop region lies outside the %dx%d image.\n", width, height);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    if ((passes > 1 && interlaced_over_budget(decode, rowbytes, height)) ||
+        begin_sink(png_ptr, info_ptr, sink, &region, pixel_bytes)) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    if (passes > 1) {
+        read_interlaced(png_ptr, rowbytes, height, &region, pixel_bytes, sink, &pixels);
+    } else {
+        // One row buffer, reused for every row
+        row = (unsigned char *)pool_alloc(rowbytes);
+        if (!row)
+            png_error(png_ptr, "Couldn't allocate memory for PNG row");
+
+        // Rows below the region are never decoded
+        for (int y = 0; y < region.y + region.height; y++) {
+            uint64_t span = trace_begin();
+            png_read_row(png_ptr, row, NULL);
+            trace_end("png_read_row", span);
+            if (y >= region.y)
+                sink->row(sink->user, row + region.x * pixel_bytes);
+        }
+    }
+
+    pool_free(row);
+    pool_free(pixels);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Adam7 refinement: every pass is read into the full image with
+// libpng's "rectangle" display, which fills each pixel not yet
+// decoded from the sample above and to the left of it. Frames start at
+// the earliest pass dense enough for the output grid.
+// -------------------------------------------------------------
+
+// Sample spacing once passes 1..n are in (index n - 1)
+static const int adam7_x_step[7] = {8, 4, 4, 2, 2, 1, 1};
+static const int adam7_y_step[7] = {8, 8, 4, 4, 2, 2, 1};
+
+static int first_useful_pass(const Region *region, int out_width, int out_height) {
+    for (int pass = 0; pass < 6; pass++) {
+        if (region->width >= out_width * adam7_x_step[pass] && region->height >= out_height * adam7_y_step[pass])
+            return pass;
+    }
+    return 6;
+}
+
+int decode_png_passes(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink,
+                      const RefineOptions *refine) {
+    if (size < 8 || png_sig_cmp(data, 0, 8)) {
+        fprintf(stderr, "Not a valid PNG file\n");
+        return 1;
+    }
+
+    PNGSource src = { data, size, 8 };
+    double start = monotonic_ms();
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
 
+    // volatile: these are assigned after setjmp and freed on longjmp
+    png_bytep *volatile row_pointers = NULL;
+    unsigned char *volatile pixels = NULL;
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        fprintf(stderr, "Error reading PNG\n");
+        pool_free(row_pointers);
+        pool_free(pixels);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    png_set_read_fn(png_ptr, &src, read_from_memory);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
+
+    if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_ADAM7) {
+        // Nothing to refine: one ordinary frame
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        int failed = decode_png(data, size, decode, sink);
+        if (!failed)
+            refine->frame_done(refine->user, 1);
+        return failed;
+    }
+
+    int width = png_get_image_width(png_ptr, info_ptr);
+    int height = png_get_image_height(png_ptr, info_ptr);
+    int passes = png_set_interlace_handling(png_ptr);
+    int pixel_bytes = set_transforms(png_ptr, info_ptr, sink);
     png_read_update_info(png_ptr, info_ptr);
 
-    int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-    img.pixels = (unsigned char *)malloc(rowbytes * img.height);
-    png_bytep *row_pointers = (png_bytep *)malloc(sizeof(png_bytep) * img.height);
+    size_t rowbytes = png_get_rowbytes(png_ptr, info_ptr);
 
-    for (int y = 0; y < img.height; y++)
-        row_pointers[y] = img.pixels + y * rowbytes;
+    Region region = decode->crop;
+    if (region_clamp(&region, width, height)) {
+        fprintf(stderr, "Crop region lies outside the %dx%d image.\n", width, height);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
 
-    png_read_image(png_ptr, row_pointers);
+    int out_width, out_height;
+    sink->plan(sink->user, region.width, region.height, &out_width, &out_height);
+    int first_pass = first_useful_pass(&region, out_width, out_height);
+
+    if (interlaced_over_budget(decode, rowbytes, height) ||
+        begin_sink(png_ptr, info_ptr, sink, &region, pixel_bytes)) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    pixels = (unsigned char *)pool_calloc(height, rowbytes);
+    row_pointers = (png_bytep *)pool_alloc(sizeof(png_bytep) * height);
+    if (!pixels || !row_pointers)
+        png_error(png_ptr, "Couldn't allocate memory for PNG pixels");
+
+    for (int y = 0; y < height; y++)
+        row_pointers[y] = pixels + y * rowbytes;
+
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t span = trace_begin();
+        png_read_rows(png_ptr, NULL, row_pointers, height);
+        trace_end("png_read_rows", span);
+        if (pass < first_pass)
+            continue;
+
+        for (int y = region.y; y < region.y + region.height; y++)
+            sink->row(sink->user, row_pointers[y] + region.x * pixel_bytes);
+        refine->frame_done(refine->user, pass + 1);
+
+        // Later passes are never read once the budget is spent
+        if (refine->time_budget_ms > 0 && monotonic_ms() - start >= refine->time_budget_ms)
+            break;
+    }
+
+    pool_free(row_pointers);
+    pool_free(pixels);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Progressive reader for non-seekable input (pipes, stdin)
+// -------------------------------------------------------------
+typedef struct {
+    RowSink *sink;
+    unsigned char *pixels; // Only allocated for interlaced images
+    size_t rowbytes;
+    int pixel_bytes;
+    Region region;
+    const DecodeOptions *decode;
+    int failed;
+    int done;
+} PNGStream;
+
+static void stream_info_callback(png_structp png_ptr, png_infop info_ptr) {
+    PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png_ptr);
+
+    int width = png_get_image_width(png_ptr, info_ptr);
+    int height = png_get_image_height(png_ptr, info_ptr);
+
+    int passes = png_set_interlace_handling(png_ptr);
+    stream->pixel_bytes = set_transforms(png_ptr, info_ptr, stream->sink);
+    png_read_update_info(png_ptr, info_ptr);
+
+    stream->rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+
+    if (region_clamp(&stream->region, width, height)) {
+        fprintf(stderr, "Crop region lies outside the %dx%d image.\n", width, height);
+        stream->failed = 1;
+        png_error(png_ptr, "Invalid crop region");
+    }
+
+    if (passes > 1 && interlaced_over_budget(stream->decode, stream->rowbytes, height)) {
+        stream->failed = 1;
+        png_error(png_ptr, "Over memory budget");
+    }
+
+    if (begin_sink(png_ptr, info_ptr, stream->sink, &stream->region, stream->pixel_bytes)) {
+        stream->failed = 1;
+        png_error(png_ptr, "Couldn't start rendering");
+    }
+
+    if (passes > 1) {
+        stream->pixels = (unsigned char *)pool_calloc(height, stream->rowbytes);
+        if (!stream->pixels)
+            png_error(png_ptr, "Couldn't allocate memory for PNG pixels");
+    }
+}
+
+static void stream_row_callback(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num, int pass) {
+    (void)pass;
+    PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png_ptr);
+
+    if (!stream->pixels) {
+        const Region *region = &stream->region;
+        if (new_row && (int)row_num >= region->y && (int)row_num < region->y + region->height)
+            stream->sink->row(stream->sink->user, new_row + region->x * stream->pixel_bytes);
+        return;
+    }
+
+    png_progressive_combine_row(png_ptr, stream->pixels + row_num * stream->rowbytes, new_row);
+}
+
+static void stream_end_callback(png_structp png_ptr, png_infop info_ptr) {
+    (void)info_ptr;
+    PNGStream *stream = (PNGStream *)png_get_progressive_ptr(png_ptr);
+
+    if (stream->pixels) {
+        const Region *region = &stream->region;
+        for (int y = region->y; y < region->y + region->height; y++)
+            stream->sink->row(stream->sink->user, stream->pixels + y * stream->rowbytes + region->x * stream->pixel_bytes);
+    }
+    stream->done = 1;
+}
+
+int decode_png_stream(FILE *fp, const unsigned char *head, size_t head_size, const DecodeOptions *decode, RowSink *sink) {
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+
+    // volatile: the stream state outlives a longjmp out of png_process_data
+    PNGStream *volatile stream = (PNGStream *)calloc(1, sizeof(PNGStream));
+    unsigned char *volatile chunk = (unsigned char *)pool_alloc(PNG_STREAM_CHUNK_SIZE);
+
+    if (!stream || !chunk) {
+        fprintf(stderr, "Couldn't allocate memory for PNG stream.\n");
+        free(stream);
+        pool_free(chunk);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    // setjmp may only stand alone in the condition (C11 7.13.1.1)
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        if (!stream->failed)
+            fprintf(stderr, "Error reading PNG\n");
+        pool_free(stream->pixels);
+        free(stream);
+        pool_free(chunk);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+    }
+
+    stream->sink = sink;
+    stream->region = decode->crop;
+    stream->decode = decode;
+    png_set_progressive_read_fn(png_ptr, stream, stream_info_callback, stream_row_callback, stream_end_callback);
+
+    // Bytes already pulled off the stream for format detection
+    png_process_data(png_ptr, info_ptr, (png_bytep)head, head_size);
+
+    while (!stream->done) {
+        int previous = stats_enter(STATS_READ);
+        uint64_t span = trace_begin();
+        size_t bytes_read = fread(chunk, 1, PNG_STREAM_CHUNK_SIZE, fp);
+        trace_end("read", span);
+        stats_leave(previous);
+        stats_add(STATS_BYTES_READ, bytes_read);
+        if (bytes_read == 0)
+            png_error(png_ptr, "Unexpected end of PNG stream");
+        span = trace_begin();
+        png_process_data(png_ptr, info_ptr, chunk, bytes_read);
+        trace_end("png_process_data", span);
+    }
 
-    free(row_pointers);
-    fclose(fp);
+    pool_free(stream->pixels);
+    free(stream);
+    pool_free(chunk);
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
-    return img;
+    return 0;
 }
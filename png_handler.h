@@ -1,12 +1,21 @@
 #ifndef PNG_HANDLER_H
 #define PNG_HANDLER_H
 
-typedef struct {
-    unsigned char *pixels;
-    int width;
-    int height;
-} PNGImage;
+#include <stddef.h>
+#include <stdio.h>
+#include "row_sink.h"
 
-PNGImage load_png(const char *filename);
+// Bytes fed to the progressive reader per read from a stream
+#define PNG_STREAM_CHUNK_SIZE (64 * 1024)
+
+// Both decoders push 8-bit RGBA rows of the cropped region into the sink
+// as they are decoded and return 0 on success.
+int decode_png(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink);
+int decode_png_stream(FILE *fp, const unsigned char *head, size_t head_size, const DecodeOptions *decode, RowSink *sink);
+
+// Adam7 images are refined pass by pass, starting from the first pass with
+// enough samples for the output grid; other PNGs produce one frame.
+int decode_png_passes(const unsigned char *data, size_t size, const DecodeOptions *decode, RowSink *sink,
+                      const RefineOptions *refine);
 
 #endif
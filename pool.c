@@ -0,0 +1,192 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Cached blocks, and the most memory they may hold between images. The
+// slots outnumber the blocks one render uses (a JPEG preview and its
+// refinement together hold 34 at once), so no freed block is turned
+// away for want of a slot while the cache has room.
+#define POOL_SLOTS 64
+#define POOL_CACHE_LIMIT ((size_t)256 << 20)
+// Smallest block handed out; tiny requests share one size class
+#define POOL_MIN_BLOCK 4096
+
+// Each block is preceded by a lead of one alignment unit, which keeps
+// the caller's pointer on the boundary the system allocator gave: a
+// cache line, or a huge page for huge blocks. The lead's last cache
+// line holds the header; the rest of a huge lead is never touched.
+typedef struct {
+    size_t capacity;
+    size_t lead; // Bytes from the system allocation to the block
+} PoolHeader;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *cached[POOL_SLOTS];
+static size_t cached_bytes;
+static PoolStats counts;
+
+static PoolHeader *block_header(const unsigned char *block)
+{
+    return (PoolHeader *)(block - POOL_ALIGNMENT);
+}
+
+static size_t block_capacity(const unsigned char *block)
+{
+    return block_header(block)->capacity;
+}
+
+// -------------------------------------------------------------
+// Helper: Round a request up to its size class: powers of two up
+// to a huge page, whole huge pages above. Coarse classes are what
+// let a block serve the next image of similar size. 0 for sizes
+// whose class and lead wouldn't fit in a size_t.
+// -------------------------------------------------------------
+static size_t size_class(size_t size)
+{
+    if (size > SIZE_MAX - 2 * (size_t)POOL_HUGE_PAGE)
+        return 0;
+    if (size >= POOL_HUGE_PAGE)
+        return (size + POOL_HUGE_PAGE - 1) & ~(size_t)(POOL_HUGE_PAGE - 1);
+
+    size_t capacity = POOL_MIN_BLOCK;
+    while (capacity < size)
+        capacity *= 2;
+    return capacity;
+}
+
+static unsigned char *system_alloc(size_t capacity)
+{
+    size_t alignment = capacity >= POOL_HUGE_PAGE ? POOL_HUGE_PAGE : POOL_ALIGNMENT;
+    void *base;
+#ifdef _WIN32
+    base = _aligned_malloc(alignment + capacity, alignment);
+    if (base == NULL)
+        return NULL;
+#else
+    if (posix_memalign(&base, alignment, alignment + capacity) != 0)
+        return NULL;
+#endif
+
+    unsigned char *block = (unsigned char *)base + alignment;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // Only a hint: transparent huge pages may be disabled or unavailable
+    if (capacity >= POOL_HUGE_PAGE)
+        madvise(block, capacity, MADV_HUGEPAGE);
+#endif
+
+    PoolHeader *header = block_header(block);
+    header->capacity = capacity;
+    header->lead = alignment;
+    return block;
+}
+
+static void system_free(unsigned char *block)
+{
+    unsigned char *base = block - block_header(block)->lead;
+#ifdef _WIN32
+    _aligned_free(base);
+#else
+    free(base);
+#endif
+}
+
+void *pool_alloc(size_t size)
+{
+    size_t capacity = size_class(size);
+    if (capacity == 0)
+        return NULL;
+
+    // Best fit among cached blocks of the same class or one above
+    pthread_mutex_lock(&pool_lock);
+    counts.allocations++;
+    int best = -1;
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (cached[i] == NULL)
+            continue;
+        size_t have = block_capacity(cached[i]);
+        if (have >= capacity && have <= capacity * 2 && (best < 0 || have < block_capacity(cached[best])))
+            best = i;
+    }
+
+    unsigned char *block = NULL;
+    if (best >= 0)
+    {
+        block = cached[best];
+        cached[best] = NULL;
+        cached_bytes -= block_capacity(block);
+        counts.cache_hits++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return block ? block : system_alloc(capacity);
+}
+
+void *pool_calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    void *block = pool_alloc(count * size);
+    if (block)
+        memset(block, 0, count * size);
+    return block;
+}
+
+void pool_free(void *pointer)
+{
+    unsigned char *block = pointer;
+    if (block == NULL)
+        return;
+
+    size_t capacity = block_capacity(block);
+
+    pthread_mutex_lock(&pool_lock);
+    if (cached_bytes + capacity <= POOL_CACHE_LIMIT)
+    {
+        for (int i = 0; i < POOL_SLOTS; i++)
+        {
+            if (cached[i] == NULL)
+            {
+                cached[i] = block;
+                cached_bytes += capacity;
+                block = NULL;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    // No room in the cache
+    if (block)
+        system_free(block);
+}
+
+void pool_trim(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (cached[i])
+            system_free(cached[i]);
+        cached[i] = NULL;
+    }
+    cached_bytes = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void pool_stats(PoolStats *stats)
+{
+    pthread_mutex_lock(&pool_lock);
+    *stats = counts;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,28 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Every block starts on a cache line, which also suits SIMD loads
+#define POOL_ALIGNMENT 64
+// Blocks at least this large are placed on huge-page boundaries
+#define POOL_HUGE_PAGE (2u << 20)
+
+// Recycling allocator for per-image buffers: pixel rows, row pointers,
+// band buffers, resampler scratch. Freed blocks are kept and handed out
+// again for requests of similar size, so rendering a stream of images
+// of comparable size settles into making no allocations at all.
+// Thread-safe; the preview decodes on a worker thread.
+typedef struct {
+    size_t allocations; // pool_alloc() calls
+    size_t cache_hits;  // Of which served from a cached block
+} PoolStats;
+
+void *pool_alloc(size_t size);
+void *pool_calloc(size_t count, size_t size);
+void pool_free(void *block);
+// Release every cached block back to the system
+void pool_trim(void);
+void pool_stats(PoolStats *stats);
+
+#endif
@@ -0,0 +1,149 @@
+#include "preview.h"
+#include "jpeg_handler.h"
+#include "png_handler.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
+#include <pthread.h>
+#include <string.h>
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    DecodeOptions decode;
+    RenderPipeline pipeline;
+    int failed;
+} RefineJob;
+
+static void *refine_worker(void *arg)
+{
+    RefineJob *job = arg;
+    RowSink sink = render_pipeline_sink(&job->pipeline);
+    trace_name_thread("refine");
+    int previous = stats_enter(STATS_DECODE);
+    uint64_t span = trace_begin();
+    job->failed = decode_jpeg(job->data, job->size, &job->decode, &sink);
+    trace_end("decode full image", span);
+    stats_leave(previous);
+    return NULL;
+}
+
+int render_jpeg_refined(const unsigned char *data, size_t size, const DecodeOptions *decode, const RenderOptions *options,
+                        RenderOutput *out, PreviewStats *stats)
+{
+    double start = monotonic_ms();
+    *stats = (PreviewStats){0};
+
+    // Full quality, decoded into a grid in the background. The preview
+    // keeps the caller's TurboJPEG instance; the worker can't share it.
+    RefineJob job = {.data = data, .size = size, .decode = *decode};
+    job.decode.turbojpeg = NULL;
+    render_pipeline_init(&job.pipeline, options, out);
+    job.pipeline.capture = 1;
+
+    pthread_t worker;
+    int threaded = pthread_create(&worker, NULL, refine_worker, &job) == 0;
+    if (!threaded)
+        refine_worker(&job);
+
+    // Preview on this thread, kept as a grid so the refinement can diff it
+    RenderPipeline preview;
+    render_pipeline_init(&preview, options, out);
+    preview.capture = 1;
+    RowSink sink = render_pipeline_sink(&preview);
+
+    int shown = decode_jpeg_preview(data, size, decode, &sink) == 0;
+    if (shown)
+    {
+        render_grid(&preview.renderer, &preview.grid);
+        render_output_write(out, "\x1b" "7", 2); // Save the cursor below the image
+        render_output_flush(out);
+        stats->first_image_ms = monotonic_ms() - start;
+    }
+
+    if (threaded)
+        pthread_join(worker, NULL);
+
+    if (!job.failed)
+    {
+        if (shown)
+            stats->cells_redrawn = render_grid_diff(&job.pipeline.renderer, &preview.grid, &job.pipeline.grid);
+        else
+            render_grid(&job.pipeline.renderer, &job.pipeline.grid);
+
+        render_output_flush(out);
+        stats->final_ms = monotonic_ms() - start;
+        if (stats->first_image_ms == 0)
+            stats->first_image_ms = stats->final_ms;
+    }
+
+    render_pipeline_free(&preview);
+    render_pipeline_free(&job.pipeline);
+
+    return job.failed;
+}
+
+// -------------------------------------------------------------
+// Frame-by-frame refinement: progressive JPEG scans, Adam7 passes
+// -------------------------------------------------------------
+typedef struct {
+    RenderPipeline pipeline;
+    CellGrid shown;
+    RenderOutput *out;
+    double start;
+    PreviewStats *stats;
+} FrameDisplay;
+
+static void frame_done(void *user, int frame)
+{
+    FrameDisplay *display = user;
+    RenderPipeline *pipeline = &display->pipeline;
+    CellGrid *grid = &pipeline->grid;
+    CellGrid *shown = &display->shown;
+
+    if (shown->rows == 0)
+    {
+        render_grid(&pipeline->renderer, grid);
+        render_output_write(display->out, "\x1b" "7", 2); // Save the cursor below the image
+        display->stats->first_image_ms = monotonic_ms() - display->start;
+    }
+    else
+    {
+        display->stats->cells_redrawn += render_grid_diff(&pipeline->renderer, shown, grid);
+    }
+
+    // Keep what is on screen now for the next diff. Without memory for
+    // the colors, shown still knows its size and is redrawn whole.
+    if (shown->columns != grid->columns || shown->rows != grid->rows)
+    {
+        cell_grid_free(shown);
+        cell_grid_init(shown, grid->columns, grid->rows);
+    }
+    if (shown->rgb)
+        memcpy(shown->rgb, grid->rgb, (size_t)grid->columns * grid->rows * 3);
+
+    render_output_flush(display->out);
+    display->stats->frames = frame;
+    render_pipeline_rewind(pipeline);
+}
+
+int render_refined(ImageFormat format, const unsigned char *data, size_t size, FILE *rest, const DecodeOptions *decode,
+                   const RenderOptions *options, int time_budget_ms, RenderOutput *out, PreviewStats *stats)
+{
+    *stats = (PreviewStats){0};
+
+    FrameDisplay display = {.out = out, .start = monotonic_ms(), .stats = stats};
+    render_pipeline_init(&display.pipeline, options, out);
+    display.pipeline.capture = 1;
+
+    RowSink sink = render_pipeline_sink(&display.pipeline);
+    RefineOptions refine = {time_budget_ms, frame_done, &display};
+
+    int failed = format == FORMAT_PNG ? decode_png_passes(data, size, decode, &sink, &refine)
+                                      : decode_jpeg_scans(data, size, rest, decode, &sink, &refine);
+    stats->final_ms = monotonic_ms() - display.start;
+
+    cell_grid_free(&display.shown);
+    render_pipeline_free(&display.pipeline);
+    return failed;
+}
@@ -0,0 +1,31 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "input.h"
+#include "render.h"
+#include "row_sink.h"
+
+typedef struct {
+    double first_image_ms; // Until the first (coarse) image was on screen
+    double final_ms;       // Until the last refinement finished
+    size_t cells_redrawn;
+    int frames;            // Progressive scans or Adam7 passes shown
+} PreviewStats;
+
+// Two-stage JPEG render: a 1/8-scale preview is drawn right away while the
+// full-quality decode runs on a background thread; once it finishes, only
+// the cells that changed are redrawn in place.
+int render_jpeg_refined(const unsigned char *data, size_t size, const DecodeOptions *decode, const RenderOptions *options,
+                        RenderOutput *out, PreviewStats *stats);
+
+// Coarse-to-fine render of progressive JPEGs and Adam7 PNGs: the image is
+// drawn from the first usable scan or pass and refined in place after each
+// later one, stopping at the last complete one once time_budget_ms (0 =
+// none) runs out. With rest set, data is the sniffed head of the JPEG
+// stream rest; PNG data must be complete.
+int render_refined(ImageFormat format, const unsigned char *data, size_t size, FILE *rest, const DecodeOptions *decode,
+                   const RenderOptions *options, int time_budget_ms, RenderOutput *out, PreviewStats *stats);
+
+#endif
@@ -0,0 +1,790 @@
+#include "render.h"
+#include "kernels.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// Longest cell: "\x1b[38;2;255;255;255m" + U+2588 (3 bytes)
+#define MAX_CELL_BYTES 22
+#define ROW_RESET "\x1b[0m\n"
+// Room for the cursor motion in front of a redrawn run of cells
+#define MAX_MOTION_BYTES 32
+// How long a terminal gets to answer a query
+#define TERMINAL_REPLY_MS 100
+
+// -------------------------------------------------------------
+// Helper: Query terminal width, 0 if stdout isn't a terminal
+// -------------------------------------------------------------
+int terminal_columns(void)
+{
+#ifndef _WIN32
+    struct winsize ws;
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+        return ws.ws_col;
+#endif
+    return 0;
+}
+
+// One "rgb:" component: 1 to 4 hex digits, scaled to a byte
+static int parse_component(const char *text, char **end, unsigned char *out)
+{
+    unsigned long value = strtoul(text, end, 16);
+    int digits = (int)(*end - text);
+    if (digits < 1 || digits > 4)
+        return 1;
+    unsigned long max = (1UL << (4 * digits)) - 1;
+    *out = (unsigned char)((value * 255 + max / 2) / max);
+    return 0;
+}
+
+#ifndef _WIN32
+// -------------------------------------------------------------
+// Helper: Send queries to the terminal and collect the replies.
+// A device attributes request goes last; every terminal answers
+// it, so queries a terminal ignores cost a round trip rather than
+// the whole timeout.
+// -------------------------------------------------------------
+static size_t terminal_ask(const char *queries, char *reply, size_t capacity)
+{
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return 0;
+
+    struct termios saved, raw;
+    if (tcgetattr(fd, &saved) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &raw);
+
+    char query[64];
+    int query_length = snprintf(query, sizeof(query), "%s\x1b[c", queries);
+    size_t length = 0;
+    if (write(fd, query, query_length) == query_length)
+    {
+        // Read until the device attributes reply, "ESC [ ? ... c", ends
+        while (length < capacity - 1)
+        {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, TERMINAL_REPLY_MS) <= 0)
+                break;
+            ssize_t got = read(fd, reply + length, capacity - 1 - length);
+            if (got <= 0)
+                break;
+            length += (size_t)got;
+            reply[length] = '\0';
+            const char *attributes = strstr(reply, "\x1b[?");
+            if (attributes && strchr(attributes, 'c'))
+                break;
+        }
+    }
+    reply[length] = '\0';
+
+    tcsetattr(fd, TCSANOW, &saved);
+    close(fd);
+    return length;
+}
+
+// "ESC ] 11 ; rgb:RRRR/GGGG/BBBB", ended by BEL or ST
+static int parse_background(const char *reply, unsigned char *rgb)
+{
+    const char *color = strstr(reply, "]11;rgb:");
+    if (color == NULL)
+        return 1;
+
+    char *end = (char *)color + strlen("]11;rgb:");
+    for (int k = 0; k < 3; k++)
+    {
+        if (parse_component(end, &end, &rgb[k]) || (k < 2 && *end++ != '/'))
+            return 1;
+    }
+    return 0;
+}
+
+// "ESC [ 6 ; height ; width t", the cell size in pixels
+static int parse_cell_size(const char *reply, int *width, int *height)
+{
+    const char *size = strstr(reply, "\x1b[6;");
+    char trailing;
+    return size == NULL || sscanf(size + 4, "%d;%d%c", height, width, &trailing) != 3 || trailing != 't' ||
+           *width <= 0 || *height <= 0;
+}
+#endif
+
+void terminal_query(TerminalInfo *info, int want_background)
+{
+    memset(info, 0, sizeof(*info));
+#ifndef _WIN32
+    if (!isatty(STDOUT_FILENO))
+        return;
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0 && ws.ws_xpixel > 0 &&
+        ws.ws_ypixel > 0)
+    {
+        info->cell_width = ws.ws_xpixel / ws.ws_col;
+        info->cell_height = ws.ws_ypixel / ws.ws_row;
+    }
+
+    char queries[32] = "";
+    if (want_background)
+        strcat(queries, "\x1b]11;?\x07");
+    if (info->cell_height == 0)
+        strcat(queries, "\x1b[16t");
+    if (queries[0] == '\0')
+        return;
+
+    char reply[256];
+    terminal_ask(queries, reply, sizeof(reply));
+    info->has_background = want_background && parse_background(reply, info->background) == 0;
+    if (info->cell_height == 0 && parse_cell_size(reply, &info->cell_width, &info->cell_height))
+        info->cell_width = info->cell_height = 0;
+#else
+    (void)want_background;
+#endif
+}
+
+int renderer_init(Renderer *renderer, RenderOutput *out, int width, const RenderOptions *options)
+{
+    renderer->out = out;
+    renderer->colors = options->colors;
+    renderer->dither = options->colors == COLOR_TRUECOLOR ? DITHER_NONE : options->dither;
+    renderer->sparse = options->sparse;
+    renderer->tolerance = options->tolerance;
+    memcpy(renderer->background, options->background, 3);
+    renderer->row = 0;
+    renderer->capacity = (size_t)width * MAX_CELL_BYTES + MAX_MOTION_BYTES + sizeof(ROW_RESET);
+    renderer->line = pool_alloc(renderer->capacity);
+    renderer->indices = renderer->colors == COLOR_256 ? pool_alloc(width > 0 ? width : 1) : NULL;
+    if (renderer->line == NULL || (renderer->colors == COLOR_256 && renderer->indices == NULL))
+    {
+        renderer_free(renderer);
+        return 1;
+    }
+    return 0;
+}
+
+// Append a decimal byte value without going through printf
+static char *put_u8(char *p, unsigned char v)
+{
+    if (v >= 100)
+        *p++ = '0' + v / 100;
+    if (v >= 10)
+        *p++ = '0' + v / 10 % 10;
+    *p++ = '0' + v % 10;
+    return p;
+}
+
+// Append a decimal int, for cursor motion arguments
+static char *put_int(char *p, int v)
+{
+    char digits[12];
+    int n = 0;
+    do
+        digits[n++] = '0' + v % 10;
+    while ((v /= 10) > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+// -------------------------------------------------------------
+// xterm 256-color quantization is a pixel kernel (see kernels.h);
+// dithering adds these 4x4 Bayer thresholds, centered and scaled to
+// about one cube step, and keeps to the cube so neighbours blend evenly
+// -------------------------------------------------------------
+static const signed char bayer_offset[4][4] = {
+    {-19, 1, -14, 6},
+    {11, -9, 16, -4},
+    {-11, 9, -16, 4},
+    {19, -1, 14, -6},
+};
+
+// Palette indices of a run of pixels starting at column x of output row y
+static void quantize_run(const Renderer *renderer, const unsigned char *pixels, int x, int y, int width, int channels)
+{
+    signed char dither[4];
+    for (int k = 0; k < 4; k++)
+        dither[k] = bayer_offset[y & 3][(x + k) & 3];
+    pixel_kernels()->quantize_256(pixels, channels, renderer->dither == DITHER_ORDERED ? dither : NULL,
+                                  renderer->indices, width);
+}
+
+// One cell: the pixel itself in truecolor, else its palette index
+static char *put_cell(const Renderer *renderer, char *p, const unsigned char *px, int g, int b, unsigned char index)
+{
+    if (renderer->colors == COLOR_TRUECOLOR)
+    {
+        memcpy(p, "\x1b[38;2;", 7);
+        p = put_u8(p + 7, px[0]);
+        *p++ = ';';
+        p = put_u8(p, px[g]);
+        *p++ = ';';
+        p = put_u8(p, px[b]);
+    }
+    else
+    {
+        memcpy(p, "\x1b[38;5;", 7);
+        p = put_u8(p + 7, index);
+    }
+    memcpy(p, "m\xe2\x96\x88", 4); // U+2588 FULL BLOCK
+    return p + 4;
+}
+
+// -------------------------------------------------------------
+// Sparse output: cells that already look like the terminal
+// background (transparent ones have been composited into exactly
+// that) are left to the terminal instead of painted.
+// -------------------------------------------------------------
+static int skippable(const Renderer *renderer, const unsigned char *px, int g, int b)
+{
+    const unsigned char *bg = renderer->background;
+    return renderer->sparse && abs(px[0] - bg[0]) <= renderer->tolerance &&
+           abs(px[g] - bg[1]) <= renderer->tolerance && abs(px[b] - bg[2]) <= renderer->tolerance;
+}
+
+// Pass over count skipped cells: the shorter of spaces (only the
+// foreground is ever set, so they show the default background) and
+// CSI n C. Erasing always overwrites them with spaces.
+static char *put_skip(char *p, int count, int erase)
+{
+    if (!erase)
+        stats_add(STATS_CELLS_SKIPPED, count);
+    if (!erase && count > 4)
+    {
+        memcpy(p, "\x1b[", 2);
+        p = put_int(p + 2, count);
+        *p++ = 'C';
+        return p;
+    }
+    memset(p, ' ', count);
+    return p + count;
+}
+
+// Cells for a run of pixels that starts at column x of output row y.
+// Gray pixels (one channel) are repeated into all three components.
+// Without erase, skipped cells at the end of the run are left out.
+static char *put_cells(const Renderer *renderer, char *p, const unsigned char *pixels, int x, int y, int width,
+                       int channels, int erase)
+{
+    const int g = channels >= 3 ? 1 : 0, b = channels >= 3 ? 2 : 0;
+    int skipped = 0;
+    if (renderer->colors == COLOR_256)
+        quantize_run(renderer, pixels, x, y, width, channels);
+
+    for (int i = 0; i < width; i++)
+    {
+        const unsigned char *px = pixels + i * channels;
+        if (skippable(renderer, px, g, b))
+        {
+            skipped++;
+            continue;
+        }
+        if (skipped > 0)
+            p = put_skip(p, skipped, erase);
+        skipped = 0;
+        p = put_cell(renderer, p, px, g, b, renderer->colors == COLOR_256 ? renderer->indices[i] : 0);
+    }
+
+    if (skipped > 0 && erase)
+        p = put_skip(p, skipped, erase);
+    return p;
+}
+
+// SGR sequences in a run of output, for --stats
+static uint64_t count_sgr(const char *p, const char *end)
+{
+    uint64_t count = 0;
+    while ((p = memchr(p, '\x1b', end - p)) != NULL)
+    {
+        p++;
+        if (p < end && *p == '[')
+        {
+            while (++p < end && ((*p >= '0' && *p <= '9') || *p == ';'))
+                ;
+            count += p < end && *p == 'm';
+        }
+    }
+    return count;
+}
+
+void render_output_write(RenderOutput *out, const char *text, size_t length)
+{
+    if (out->failed)
+        return;
+
+    int previous = stats_enter(STATS_WRITE);
+    uint64_t span = trace_begin();
+    if (out->file)
+        out->failed = fwrite(text, 1, length, out->file) != length;
+    else
+        out->failed = out->write(out->user, text, length) != 0;
+    trace_end("write", span);
+    stats_leave(previous);
+    stats_add(STATS_BYTES_WRITTEN, length);
+}
+
+void render_output_flush(RenderOutput *out)
+{
+    if (out->file == NULL)
+        return;
+
+    int previous = stats_enter(STATS_WRITE);
+    uint64_t span = trace_begin();
+    fflush(out->file);
+    trace_end("flush", span);
+    stats_leave(previous);
+}
+
+// All rendered text leaves through here, from the start of the line
+// buffer up to end
+static void put_line(Renderer *renderer, const char *end)
+{
+    size_t length = end - renderer->line;
+    if (stats_enabled)
+        stats_add(STATS_SGR, count_sgr(renderer->line, end));
+
+    render_output_write(renderer->out, renderer->line, length);
+}
+
+void render_row(Renderer *renderer, const unsigned char *pixels, int width, int channels)
+{
+    char *p = put_cells(renderer, renderer->line, pixels, 0, renderer->row++, width, channels, 0);
+
+    memcpy(p, ROW_RESET, sizeof(ROW_RESET) - 1);
+    p += sizeof(ROW_RESET) - 1;
+
+    put_line(renderer, p);
+}
+
+// -------------------------------------------------------------
+// CellTable: every cell a one-byte pixel can produce, rendered
+// once up front so each row is a lookup and a copy per cell
+// -------------------------------------------------------------
+struct CellTable {
+    char cell[256][MAX_CELL_BYTES];
+    unsigned char length[256];
+    unsigned char skip[256]; // Sparse output leaves these cells out
+};
+
+// Only valid when a cell's text depends on its color alone, i.e. no dithering
+static CellTable *cell_table_create(const Renderer *renderer, const unsigned char *colors, int stride)
+{
+    CellTable *table = pool_alloc(sizeof(CellTable));
+    if (table == NULL)
+        return NULL;
+
+    for (int i = 0; i < 256; i++)
+    {
+        const unsigned char *px = colors + i * stride;
+        unsigned char index = 0;
+        if (renderer->colors == COLOR_256)
+            pixel_kernels()->quantize_256(px, 3, NULL, &index, 1);
+        char *end = put_cell(renderer, table->cell[i], px, 1, 2, index);
+        table->length[i] = (unsigned char)(end - table->cell[i]);
+        table->skip[i] = (unsigned char)skippable(renderer, px, 1, 2);
+    }
+    return table;
+}
+
+static void render_table_row(Renderer *renderer, const CellTable *table, const unsigned char *values, int width)
+{
+    char *p = renderer->line;
+    int skipped = 0;
+    for (int x = 0; x < width; x++)
+    {
+        if (table->skip[values[x]])
+        {
+            skipped++;
+            continue;
+        }
+        if (skipped > 0)
+            p = put_skip(p, skipped, 0);
+        skipped = 0;
+
+        // Fixed-size copy: the line always has room for a whole cell more
+        memcpy(p, table->cell[values[x]], MAX_CELL_BYTES);
+        p += table->length[values[x]];
+    }
+
+    memcpy(p, ROW_RESET, sizeof(ROW_RESET) - 1);
+    p += sizeof(ROW_RESET) - 1;
+
+    put_line(renderer, p);
+    renderer->row++;
+}
+
+void renderer_free(Renderer *renderer)
+{
+    pool_free(renderer->line);
+    pool_free(renderer->indices);
+    renderer->line = NULL;
+    renderer->indices = NULL;
+}
+
+// -------------------------------------------------------------
+// CellGrid: a whole frame of output colors, for in-place redraws
+// -------------------------------------------------------------
+int cell_grid_init(CellGrid *grid, int columns, int rows)
+{
+    grid->columns = columns;
+    grid->rows = rows;
+    grid->rgb = pool_calloc((size_t)columns * rows, 3);
+    return grid->rgb == NULL;
+}
+
+void cell_grid_free(CellGrid *grid)
+{
+    pool_free(grid->rgb);
+    grid->rgb = NULL;
+}
+
+void render_grid(Renderer *renderer, const CellGrid *grid)
+{
+    int previous = stats_enter(STATS_RENDER);
+    uint64_t span = trace_begin();
+    renderer->row = 0;
+    for (int y = 0; y < grid->rows; y++)
+        render_row(renderer, grid->rgb + (size_t)y * grid->columns * 3, grid->columns, 3);
+    trace_end("serialize grid", span);
+    stats_leave(previous);
+}
+
+// Draw next in place of a grid of shown_rows rows: from the saved
+// position back up to its first line, erase from there down, draw, and
+// save the position below the new grid instead
+static size_t render_grid_replace(Renderer *renderer, int shown_rows, const CellGrid *next)
+{
+    char *p = renderer->line;
+    memcpy(p, "\x1b" "8\x1b[", 4);
+    p = put_int(p + 4, shown_rows);
+    memcpy(p, "A\r\x1b[J", 5);
+    put_line(renderer, p + 5);
+
+    render_grid(renderer, next);
+
+    memcpy(renderer->line, "\x1b" "7", 2);
+    put_line(renderer, renderer->line + 2);
+    return (size_t)next->columns * next->rows;
+}
+
+// Redraw only the cells of next that differ from shown. The cursor must
+// sit on the line below the drawn grid and have been saved there (ESC 7);
+// every run of dirty cells is addressed relative to that saved position.
+// A grid of another size (or shown without its colors) is redrawn whole,
+// over the old one.
+size_t render_grid_diff(Renderer *renderer, const CellGrid *shown, const CellGrid *next)
+{
+    if (shown->rgb == NULL || shown->columns != next->columns || shown->rows != next->rows)
+        return render_grid_replace(renderer, shown->rows, next);
+
+    int previous = stats_enter(STATS_RENDER);
+    uint64_t span = trace_begin();
+    size_t redrawn = 0;
+
+    for (int y = 0; y < next->rows; y++)
+    {
+        const unsigned char *old_row = shown->rgb + (size_t)y * shown->columns * 3;
+        const unsigned char *new_row = next->rgb + (size_t)y * next->columns * 3;
+
+        int x = 0;
+        while (x < next->columns)
+        {
+            if (memcmp(old_row + x * 3, new_row + x * 3, 3) == 0)
+            {
+                x++;
+                continue;
+            }
+
+            int start = x;
+            while (x < next->columns && memcmp(old_row + x * 3, new_row + x * 3, 3) != 0)
+                x++;
+
+            // ESC 8, CSI n A (up), CSI n G (column)
+            char *p = renderer->line;
+            memcpy(p, "\x1b" "8\x1b[", 4);
+            p = put_int(p + 4, next->rows - y);
+            memcpy(p, "A\x1b[", 3);
+            p = put_int(p + 3, start + 1);
+            *p++ = 'G';
+            p = put_cells(renderer, p, new_row + start * 3, start, y, x - start, 3, 1);
+            put_line(renderer, p);
+
+            redrawn += x - start;
+        }
+    }
+
+    static const char restore[] = "\x1b[0m\x1b" "8";
+    memcpy(renderer->line, restore, sizeof(restore) - 1);
+    put_line(renderer, renderer->line + sizeof(restore) - 1);
+    trace_end("serialize diff", span);
+    stats_leave(previous);
+    return redrawn;
+}
+
+// -------------------------------------------------------------
+// RenderPipeline: RowSink -> Resampler -> Renderer
+// -------------------------------------------------------------
+static void pipeline_emit(void *user, const unsigned char *row, int width, int channels)
+{
+    RenderPipeline *pipeline = user;
+
+    if (!pipeline->capture)
+    {
+        int previous = stats_enter(STATS_RENDER);
+        uint64_t span = trace_begin();
+        if (pipeline->cells)
+            render_table_row(&pipeline->renderer, pipeline->cells, row, width);
+        else
+            render_row(&pipeline->renderer, row, width, channels);
+        trace_end("serialize", span);
+        stats_leave(previous);
+        return;
+    }
+
+    unsigned char *cell = pipeline->grid.rgb + (size_t)pipeline->grid_row++ * width * 3;
+    for (int x = 0; x < width; x++, cell += 3, row += channels)
+    {
+        if (channels == 1)
+            memset(cell, row[0], 3);
+        else
+            memcpy(cell, row, 3);
+    }
+}
+
+void render_plan(const RenderOptions *options, int width, int height, int *columns, int *rows)
+{
+    int grid_columns = options->width;
+    if (grid_columns <= 0)
+    {
+        grid_columns = terminal_columns();
+        if (grid_columns <= 0 || grid_columns > width)
+            grid_columns = width;
+    }
+
+    // Cells are taller than wide: scale rows by the cell shape, so the
+    // resampler corrects the aspect ratio in the same pass
+    long long cell_width = options->cell_height > 0 ? options->cell_width : 1;
+    long long cell_height = options->cell_height > 0 ? options->cell_height : 2;
+    long long span = (long long)width * cell_height;
+    int grid_rows = (int)(((long long)height * grid_columns * cell_width + span / 2) / span);
+
+    *columns = grid_columns;
+    *rows = grid_rows < 1 ? 1 : grid_rows;
+}
+
+static void pipeline_plan(void *user, int width, int height, int *out_width, int *out_height)
+{
+    RenderPipeline *pipeline = user;
+    render_plan(&pipeline->options, width, height, out_width, out_height);
+    pipeline->columns = *out_width;
+    pipeline->rows = *out_height;
+}
+
+static int pipeline_start(RenderPipeline *pipeline, int width, int height, int channels, int bits)
+{
+    // Decoders that don't downscale themselves skip plan()
+    if (pipeline->columns == 0)
+    {
+        int columns, rows;
+        pipeline_plan(pipeline, width, height, &columns, &rows);
+    }
+
+    int columns = pipeline->columns;
+    int rows = pipeline->rows;
+
+    // Lanczos keeps a row per tap, and steep downscales need many. Past
+    // the budget, box filtering gets close with a single row of sums.
+    ResampleKernel kernel = pipeline->options.kernel;
+    size_t max_memory = pipeline->options.max_memory;
+    if (kernel == RESAMPLE_LANCZOS && max_memory > 0 &&
+        resampler_ring_bytes(height, columns, rows, channels) > max_memory)
+        kernel = RESAMPLE_BOX;
+
+    if (resampler_init(&pipeline->resampler, kernel, width, height, columns, rows, channels, bits,
+                       pipeline->options.linear, pipeline_emit, pipeline))
+    {
+        fprintf(stderr, "Couldn't allocate memory for resampler.\n");
+        return 1;
+    }
+    resampler_set_background(&pipeline->resampler, pipeline->options.background);
+    if (renderer_init(&pipeline->renderer, pipeline->renderer.out, columns, &pipeline->options))
+    {
+        fprintf(stderr, "Couldn't allocate memory for output line.\n");
+        resampler_free(&pipeline->resampler);
+        return 1;
+    }
+    if (pipeline->capture && cell_grid_init(&pipeline->grid, columns, rows))
+    {
+        fprintf(stderr, "Couldn't allocate memory for cell grid.\n");
+        renderer_free(&pipeline->renderer);
+        resampler_free(&pipeline->resampler);
+        return 1;
+    }
+
+    // Grayscale stays one channel to the end: 256 possible cells
+    if (channels == 1 && !pipeline->capture && pipeline->renderer.dither == DITHER_NONE)
+    {
+        unsigned char ramp[256 * 3];
+        for (int i = 0; i < 256; i++)
+            memset(ramp + i * 3, i, 3);
+
+        pipeline->cells = cell_table_create(&pipeline->renderer, ramp, 3);
+        if (pipeline->cells == NULL)
+        {
+            fprintf(stderr, "Couldn't allocate memory for gray cells.\n");
+            cell_grid_free(&pipeline->grid);
+            renderer_free(&pipeline->renderer);
+            resampler_free(&pipeline->resampler);
+            return 1;
+        }
+    }
+
+    pipeline->started = 1;
+    return 0;
+}
+
+static int pipeline_begin(void *user, int width, int height, int channels)
+{
+    return pipeline_start(user, width, height, channels, 8);
+}
+
+// Deep sources go through the resampler as they are and only lose their
+// extra bits in its final, dithered rounding
+static int pipeline_begin_wide(void *user, int width, int height, int channels, int bits)
+{
+    return pipeline_start(user, width, height, channels, bits);
+}
+
+// Palette images: when the columns match the image's, every cell is one
+// palette entry, so rows skip the resampler and render from pre-built
+// cells, each output row from the nearest source row. Otherwise each
+// row is expanded through the palette on its way into the resampler.
+static int pipeline_begin_indexed(void *user, int width, int height, const unsigned char *palette)
+{
+    RenderPipeline *pipeline = user;
+
+    if (pipeline_start(pipeline, width, height, 4, 8))
+        return 1;
+
+    memcpy(pipeline->palette, palette, sizeof(pipeline->palette));
+    pipeline->indexed = 1;
+
+    // Each cell is one palette entry only when no rows are merged either:
+    // at the image's own height, or with the nearest kernel picking rows
+    int whole_rows = pipeline->rows == height || pipeline->options.kernel == RESAMPLE_NEAREST;
+    if (!pipeline->capture && pipeline->columns == width && whole_rows && pipeline->renderer.dither == DITHER_NONE)
+    {
+        // Translucent entries are composited once, here
+        const unsigned char *background = pipeline->options.background;
+        unsigned char opaque[256 * 4];
+        for (int i = 0; i < 256 * 4; i += 4)
+        {
+            unsigned int alpha = palette[i + 3];
+            for (int k = 0; k < 3; k++)
+                opaque[i + k] = (unsigned char)((palette[i + k] * alpha + background[k] * (255 - alpha) + 127) / 255);
+            opaque[i + 3] = 255;
+        }
+        pipeline->cells = cell_table_create(&pipeline->renderer, opaque, 4);
+    }
+    else
+        pipeline->expanded = pool_alloc((size_t)width * 4);
+
+    if (!pipeline->cells && !pipeline->expanded)
+    {
+        fprintf(stderr, "Couldn't allocate memory for palette rows.\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void pipeline_row(void *user, const unsigned char *pixels)
+{
+    RenderPipeline *pipeline = user;
+
+    if (pipeline->cells && pipeline->indexed)
+    {
+        // Output row r shows source row (2r + 1) * height / 2rows, the
+        // middle of its span, as the nearest kernel picks it
+        const int height = pipeline->resampler.src_height, rows = pipeline->rows;
+        const int y = pipeline->source_row++;
+        int previous = stats_enter(STATS_RENDER);
+        uint64_t span = trace_begin();
+        while (pipeline->cell_row < rows && (int)((2LL * pipeline->cell_row + 1) * height / (2LL * rows)) == y)
+        {
+            render_table_row(&pipeline->renderer, pipeline->cells, pixels, pipeline->columns);
+            pipeline->cell_row++;
+        }
+        trace_end("serialize", span);
+        stats_leave(previous);
+        return;
+    }
+
+    int previous = stats_enter(STATS_RESAMPLE);
+    uint64_t span = trace_begin();
+    if (pipeline->indexed)
+    {
+        unsigned char *rgba = pipeline->expanded;
+        for (int x = 0; x < pipeline->resampler.src_width; x++)
+            memcpy(rgba + x * 4, pipeline->palette + pixels[x] * 4, 4);
+        pixels = rgba;
+    }
+    resampler_push_row(&pipeline->resampler, pixels);
+    trace_end("resample", span);
+    stats_leave(previous);
+}
+
+void render_pipeline_init(RenderPipeline *pipeline, const RenderOptions *options, RenderOutput *out)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->options = *options;
+    pipeline->renderer.out = out;
+}
+
+RowSink render_pipeline_sink(RenderPipeline *pipeline)
+{
+    RowSink sink = {pipeline_plan, pipeline_begin, pipeline_begin_indexed, pipeline_begin_wide, pipeline_row, pipeline};
+    return sink;
+}
+
+void render_pipeline_rewind(RenderPipeline *pipeline)
+{
+    resampler_reset(&pipeline->resampler);
+    pipeline->grid_row = 0;
+    pipeline->source_row = 0;
+    pipeline->cell_row = 0;
+}
+
+void render_pipeline_free(RenderPipeline *pipeline)
+{
+    if (pipeline->started)
+    {
+        resampler_free(&pipeline->resampler);
+        renderer_free(&pipeline->renderer);
+        cell_grid_free(&pipeline->grid);
+        pool_free(pipeline->cells);
+        pool_free(pipeline->expanded);
+        pipeline->cells = NULL;
+        pipeline->expanded = NULL;
+        pipeline->indexed = 0;
+        pipeline->source_row = 0;
+        pipeline->cell_row = 0;
+    }
+    render_output_flush(pipeline->renderer.out);
+    pipeline->started = 0;
+}
@@ -0,0 +1,126 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "resample.h"
+#include "row_sink.h"
+
+typedef enum {
+    COLOR_TRUECOLOR, // 24-bit SGR 38;2
+    COLOR_256,       // xterm 256-color SGR 38;5, shorter escapes
+} ColorDepth;
+
+typedef enum {
+    DITHER_NONE,
+    DITHER_ORDERED, // 4x4 Bayer, when quantizing below truecolor
+} Dither;
+
+typedef struct {
+    int width; // Output columns, 0 = fit the terminal
+    ResampleKernel kernel;
+    ColorDepth colors;
+    Dither dither;
+    int linear; // Resample in linear light rather than on sRGB values
+    unsigned char background[3]; // Transparent pixels are composited over this
+    int sparse;                  // Leave cells that look like the background to the terminal
+    int tolerance;               // How far (per channel) from background that may be
+    int cell_width;              // Cell shape in pixels, for the aspect ratio; 0 = 1:2
+    int cell_height;
+    size_t max_memory;           // Bytes of resampler rows a render may hold, 0 = no limit
+} RenderOptions;
+
+// Where rendered text goes: a stream, or else a callback. Shared by
+// every renderer drawing to the same place.
+typedef struct {
+    FILE *file;
+    // Returns non-zero to refuse the text; nothing more is written then
+    int (*write)(void *user, const char *text, size_t length);
+    void *user;
+    int failed; // A write fell short or was refused
+} RenderOutput;
+
+void render_output_write(RenderOutput *out, const char *text, size_t length);
+// Push buffered text out to the terminal (streams only)
+void render_output_flush(RenderOutput *out);
+
+// Serializes pixel rows into colored text cells
+typedef struct {
+    RenderOutput *out;
+    char *line;
+    size_t capacity;
+    ColorDepth colors;
+    Dither dither;
+    int sparse;
+    int tolerance;
+    unsigned char background[3];
+    int row; // Output row of the next render_row(), for dithering
+    unsigned char *indices; // 256 colors: each cell's index, a run at a time
+} Renderer;
+
+int renderer_init(Renderer *renderer, RenderOutput *out, int width, const RenderOptions *options);
+void render_row(Renderer *renderer, const unsigned char *pixels, int width, int channels);
+void renderer_free(Renderer *renderer);
+
+// Output colors of a whole frame, kept for in-place redraws
+typedef struct {
+    int columns;
+    int rows;
+    unsigned char *rgb; // columns * rows * 3
+} CellGrid;
+
+int cell_grid_init(CellGrid *grid, int columns, int rows);
+void cell_grid_free(CellGrid *grid);
+void render_grid(Renderer *renderer, const CellGrid *grid);
+// Redraw in place whatever changed from shown to next, which may differ
+// in size. Returns the cells redrawn.
+size_t render_grid_diff(Renderer *renderer, const CellGrid *shown, const CellGrid *next);
+
+// Pre-rendered cells for the 256 values of a one-byte pixel
+typedef struct CellTable CellTable;
+
+// Decoder-facing sink: resamples incoming rows to the output grid and
+// renders each output row as soon as it is complete.
+typedef struct {
+    RenderOptions options;
+    Resampler resampler;
+    Renderer renderer;
+    int columns; // Output grid, fixed by plan()
+    int rows;
+    int capture; // Collect rows into grid instead of writing them
+    CellGrid grid;
+    int grid_row;
+    int started;
+    int indexed;                    // Rows carry palette indices
+    unsigned char palette[256 * 4]; // RGBA, from begin_indexed()
+    CellTable *cells;               // Gray cells, or palette cells when no pixels merge
+    unsigned char *expanded;        // Index row expanded for the resampler
+    int source_row;                 // Palette cells: rows received so far,
+    int cell_row;                   // and output rows rendered from them
+} RenderPipeline;
+
+void render_pipeline_init(RenderPipeline *pipeline, const RenderOptions *options, RenderOutput *out);
+RowSink render_pipeline_sink(RenderPipeline *pipeline);
+// Accept another full frame of rows from the top
+void render_pipeline_rewind(RenderPipeline *pipeline);
+void render_pipeline_free(RenderPipeline *pipeline);
+
+// Output grid for a source size: options->width columns (0 = fit the
+// terminal, but no wider than the image), rows scaled by the cell shape
+void render_plan(const RenderOptions *options, int width, int height, int *columns, int *rows);
+int terminal_columns(void);
+
+// What the terminal says about itself; zeroed fields are unknown
+typedef struct {
+    int has_background;
+    unsigned char background[3];
+    int cell_width; // Pixels
+    int cell_height;
+} TerminalInfo;
+
+// Background color (OSC 11, when want_background is set) and cell size
+// (TIOCGWINSZ, else CSI 16 t). Nothing is known if stdout isn't a
+// terminal or it doesn't answer.
+void terminal_query(TerminalInfo *info, int want_background);
+
+#endif
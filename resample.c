@@ -0,0 +1,654 @@
+#include "resample.h"
+#include "pool.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LANCZOS_LOBES 3
+#define WEIGHT_BITS 14
+// 255 in 8.8 fixed point: what a full-scale sample of any depth maps to
+#define FULL_SCALE (255 << 8)
+// Linear light: 16-bit in, 12-bit index into to_srgb out
+#define LINEAR_MAX 65535
+#define SRGB_ENTRIES 4096
+
+// 4x4 Bayer matrix, for dithering wide sources down to 8 bits
+static const unsigned char bayer[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+// -------------------------------------------------------------
+// Helper: Source span [start, end) covered by output index i.
+// Downscaling partitions the source; upscaling repeats the
+// nearest source sample. Nearest always picks the middle one.
+// -------------------------------------------------------------
+static int span_start(int i, int src, int dst)
+{
+    return (int)((int64_t)i * src / dst);
+}
+
+static int span_end(int i, int src, int dst)
+{
+    int start = span_start(i, src, dst);
+    int end = span_start(i + 1, src, dst);
+    return end > start ? end : start + 1;
+}
+
+static int kernel_start(ResampleKernel kernel, int i, int src, int dst)
+{
+    if (kernel == RESAMPLE_NEAREST)
+        return (int)(((int64_t)2 * i + 1) * src / (2 * dst));
+    return span_start(i, src, dst);
+}
+
+static int kernel_end(ResampleKernel kernel, int i, int src, int dst)
+{
+    if (kernel == RESAMPLE_NEAREST)
+        return kernel_start(kernel, i, src, dst) + 1;
+    return span_end(i, src, dst);
+}
+
+// -------------------------------------------------------------
+// Lanczos weights: taps per output pixel, and for each output
+// pixel the first tap and its 2.14 fixed-point weights. Edge
+// windows are shifted inside the source, with zero weights for
+// the samples past the edge. Taps grow with the downscale ratio,
+// so the exact weights go through a scratch row the caller
+// allocates, not the stack.
+// -------------------------------------------------------------
+static double lanczos(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+    if (x <= -LANCZOS_LOBES || x >= LANCZOS_LOBES)
+        return 0.0;
+    double px = M_PI * x;
+    return LANCZOS_LOBES * sin(px) * sin(px / LANCZOS_LOBES) / (px * px);
+}
+
+static int lanczos_taps(int src, int dst)
+{
+    double scale = src > dst ? (double)src / dst : 1.0;
+    int taps = (int)ceil(2 * LANCZOS_LOBES * scale) + 1;
+    return taps < src ? taps : src;
+}
+
+static void lanczos_weights(int src, int dst, int taps, int *start, int16_t *weights, double *w)
+{
+    double ratio = (double)src / dst;
+    double scale = ratio > 1.0 ? ratio : 1.0;
+    double support = LANCZOS_LOBES * scale;
+
+    for (int i = 0; i < dst; i++)
+    {
+        double center = (i + 0.5) * ratio - 0.5;
+        int left = (int)floor(center - support) + 1;
+        int right = (int)floor(center + support);
+        if (left < 0)
+            left = 0;
+        if (right > src - 1)
+            right = src - 1;
+
+        int first = left < src - taps ? left : src - taps;
+        start[i] = first;
+
+        double total = 0.0;
+        for (int k = 0; k < taps; k++)
+        {
+            int s = first + k;
+            w[k] = s >= left && s <= right ? lanczos((s - center) / scale) : 0.0;
+            total += w[k];
+        }
+
+        // Normalize, and put the rounding error on the heaviest tap
+        int16_t *out = weights + (size_t)i * taps;
+        int sum = 0, heaviest = 0;
+        for (int k = 0; k < taps; k++)
+        {
+            out[k] = (int16_t)lround(w[k] / total * (1 << WEIGHT_BITS));
+            sum += out[k];
+            if (out[k] > out[heaviest])
+                heaviest = k;
+        }
+        out[heaviest] += (1 << WEIGHT_BITS) - sum;
+    }
+}
+
+// -------------------------------------------------------------
+// Linear-light tables. to_linear covers every source value twice:
+// first through the sRGB curve, then as a straight ramp for alpha.
+// -------------------------------------------------------------
+static int linear_tables(Resampler *rs)
+{
+    size_t values = (size_t)rs->max_value + 1;
+    rs->to_linear = pool_alloc(2 * values * sizeof(uint16_t));
+    rs->to_srgb = pool_alloc(SRGB_ENTRIES);
+    if (!rs->to_linear || !rs->to_srgb)
+        return 1;
+
+    for (size_t v = 0; v < values; v++)
+    {
+        double c = (double)v / rs->max_value;
+        double l = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        rs->to_linear[v] = (uint16_t)lround(l * LINEAR_MAX);
+        rs->to_linear[values + v] = (uint16_t)((v * LINEAR_MAX + rs->max_value / 2) / rs->max_value);
+    }
+    for (int i = 0; i < SRGB_ENTRIES; i++)
+    {
+        double l = (double)i / (SRGB_ENTRIES - 1);
+        double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+        rs->to_srgb[i] = (unsigned char)lround(c * 255);
+    }
+    return 0;
+}
+
+// The table for channel k: alpha is already linear
+static const uint16_t *linear_table(const Resampler *rs, int k)
+{
+    return rs->to_linear + (rs->channels == 4 && k == 3 ? (size_t)rs->max_value + 1 : 0);
+}
+
+// 8.8 fixed-point linear value back to an sRGB byte
+static unsigned char linear_to_srgb(const Resampler *rs, uint32_t v)
+{
+    return rs->to_srgb[((uint64_t)v * (SRGB_ENTRIES - 1) + FULL_SCALE / 2) / FULL_SCALE];
+}
+
+size_t resampler_ring_bytes(int src_height, int dst_width, int dst_height, int channels)
+{
+    return (size_t)dst_width * channels * lanczos_taps(src_height, dst_height) * sizeof(int32_t);
+}
+
+int resampler_init(Resampler *rs, ResampleKernel kernel, int src_width, int src_height, int dst_width, int dst_height,
+                   int channels, int bits, int linear, ResamplerEmitFn emit, void *user)
+{
+    memset(rs, 0, sizeof(*rs));
+    rs->kernel = kernel;
+    rs->max_value = (1 << bits) - 1;
+    rs->src_width = src_width;
+    rs->src_height = src_height;
+    rs->dst_width = dst_width;
+    rs->dst_height = dst_height;
+    rs->channels = channels;
+    rs->premultiply = channels == 4;
+    rs->emit = emit;
+    rs->user = user;
+
+    size_t samples = (size_t)dst_width * channels;
+    rs->x_start = pool_alloc(dst_width * sizeof(int));
+    rs->x_end = pool_alloc(dst_width * sizeof(int));
+    rs->hrow = pool_alloc(samples * sizeof(uint16_t));
+    rs->accum = pool_calloc(samples, sizeof(uint32_t));
+    rs->out_row = pool_alloc(samples);
+
+    // Nearest never blends two samples, so it has nothing to linearize
+    int failed = linear && kernel != RESAMPLE_NEAREST && linear_tables(rs);
+
+    rs->kernels = pixel_kernels();
+    rs->vector = kernel == RESAMPLE_LANCZOS && bits == 8 && !rs->to_linear && !rs->premultiply;
+    if (rs->vector && channels > 1)
+        failed |= (rs->planes = pool_alloc((size_t)src_width * channels)) == NULL;
+    // 16-bit planes for 8-bit Lanczos with alpha or in linear light, and
+    // for box filtering gray and RGB in linear light. Box filtering RGBA
+    // reads each pixel once, and its fused scalar loops are as fast.
+    int split = kernel == RESAMPLE_LANCZOS ? rs->to_linear || rs->premultiply : rs->to_linear && !rs->premultiply;
+    if (split && bits == 8 && channels != 2)
+        failed |= (rs->samples = pool_alloc((size_t)src_width * channels * sizeof(uint16_t))) == NULL;
+
+    if (failed || !rs->x_start || !rs->x_end || !rs->hrow || !rs->accum || !rs->out_row)
+    {
+        resampler_free(rs);
+        return 1;
+    }
+
+    if (kernel == RESAMPLE_LANCZOS)
+    {
+        rs->x_taps = lanczos_taps(src_width, dst_width);
+        rs->y_taps = lanczos_taps(src_height, dst_height);
+        rs->x_weights = pool_alloc((size_t)dst_width * rs->x_taps * sizeof(int16_t));
+        rs->y_start = pool_alloc(dst_height * sizeof(int));
+        rs->y_weights = pool_alloc((size_t)dst_height * rs->y_taps * sizeof(int16_t));
+        rs->ring = pool_alloc(samples * rs->y_taps * sizeof(int32_t));
+        double *scratch = pool_alloc((size_t)(rs->x_taps > rs->y_taps ? rs->x_taps : rs->y_taps) * sizeof(double));
+
+        if (!rs->x_weights || !rs->y_start || !rs->y_weights || !rs->ring || !scratch)
+        {
+            pool_free(scratch);
+            resampler_free(rs);
+            return 1;
+        }
+
+        lanczos_weights(src_width, dst_width, rs->x_taps, rs->x_start, rs->x_weights, scratch);
+        lanczos_weights(src_height, dst_height, rs->y_taps, rs->y_start, rs->y_weights, scratch);
+        pool_free(scratch);
+        return 0;
+    }
+
+    for (int x = 0; x < dst_width; x++)
+    {
+        rs->x_start[x] = kernel_start(kernel, x, src_width, dst_width);
+        rs->x_end[x] = kernel_end(kernel, x, src_width, dst_width);
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Compositing. Premultiplied colors and alpha are both 8.8; the
+// result is the color over the background. Everything after the
+// horizontal pass is linear, so compositing there gives the same
+// result as compositing every output pixel.
+// -------------------------------------------------------------
+static int32_t composite(const Resampler *rs, int k, int32_t premultiplied, int32_t alpha)
+{
+    return premultiplied + (int32_t)(((int64_t)rs->background[k] * (FULL_SCALE - alpha) + FULL_SCALE / 2) / FULL_SCALE);
+}
+
+static uint16_t clamp_8_8(int32_t v)
+{
+    return (uint16_t)(v < 0 ? 0 : v > FULL_SCALE ? FULL_SCALE : v);
+}
+
+// Source sample s of a row, whatever its width
+static uint32_t source_sample(const Resampler *rs, const void *row, size_t s)
+{
+    return rs->max_value > 255 ? ((const uint16_t *)row)[s] : ((const unsigned char *)row)[s];
+}
+
+// Split an interleaved row into one contiguous plane per channel
+static const unsigned char *split_planes(Resampler *rs, const unsigned char *row)
+{
+    const int c = rs->channels;
+    const size_t width = rs->src_width;
+    if (c == 1)
+        return row;
+
+    unsigned char *planes = rs->planes;
+    for (size_t x = 0; x < width; x++)
+    {
+        for (int k = 0; k < c; k++)
+            planes[k * width + x] = row[x * c + k];
+    }
+    return planes;
+}
+
+// Split an 8-bit row into 16-bit planes for the vector kernels. RGBA
+// is premultiplied: colors times alpha, or in linear light, colors
+// scaled by alpha back to 16 bits. Linear samples are looked up once
+// each, so the kernels never need a gather.
+static const uint16_t *split_samples(Resampler *rs, const unsigned char *row)
+{
+    const size_t width = rs->src_width;
+    const uint16_t *lut = rs->to_linear;
+    uint16_t *plane = rs->samples;
+
+    if (lut == NULL)
+    {
+        rs->kernels->premultiply_rgba(row, plane, rs->src_width, rs->src_width);
+        return plane;
+    }
+    if (rs->channels == 4)
+    {
+        const uint16_t *ramp = linear_table(rs, 3);
+        for (size_t x = 0; x < width; x++, row += 4)
+        {
+            uint32_t alpha = row[3];
+            plane[x] = (uint16_t)((lut[row[0]] * alpha + 127) / 255);
+            plane[width + x] = (uint16_t)((lut[row[1]] * alpha + 127) / 255);
+            plane[2 * width + x] = (uint16_t)((lut[row[2]] * alpha + 127) / 255);
+            plane[3 * width + x] = ramp[alpha];
+        }
+        return plane;
+    }
+    if (rs->channels == 1)
+    {
+        for (size_t x = 0; x < width; x++)
+            plane[x] = lut[row[x]];
+        return plane;
+    }
+
+    // Read the row once, in order, writing the planes as three streams
+    for (size_t x = 0; x < width; x++, row += 3)
+    {
+        plane[x] = lut[row[0]];
+        plane[width + x] = lut[row[1]];
+        plane[2 * width + x] = lut[row[2]];
+    }
+    return plane;
+}
+
+// Sum of a span of samples, in runs short enough for the kernel's 32 bits
+static uint64_t sum_samples(const Resampler *rs, const uint16_t *p, uint32_t n)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i += 65536)
+        sum += rs->kernels->sum_u16(p + i, (int)(n - i < 65536 ? n - i : 65536));
+    return sum;
+}
+
+// -------------------------------------------------------------
+// Horizontal pass: average each column span to 8.8 fixed point
+// -------------------------------------------------------------
+static void reduce_row(Resampler *rs, const unsigned char *row)
+{
+    const int c = rs->channels;
+
+    for (int x = 0; x < rs->dst_width; x++)
+    {
+        const unsigned char *px = row + (size_t)rs->x_start[x] * c;
+        uint32_t n = rs->x_end[x] - rs->x_start[x];
+
+        for (int k = 0; k < c; k++)
+        {
+            uint32_t sum = 0;
+            for (uint32_t i = 0; i < n; i++)
+                sum += px[i * c + k];
+            rs->hrow[x * c + k] = (uint16_t)((((uint64_t)sum << 8) + n / 2) / n);
+        }
+    }
+}
+
+// RGBA bytes: one pass sums alpha and the alpha-weighted colors. The
+// rounding term keeps opaque pixels exactly where reduce_row puts them.
+static void reduce_premultiplied_row(Resampler *rs, const unsigned char *row)
+{
+    for (int x = 0; x < rs->dst_width; x++)
+    {
+        const unsigned char *px = row + (size_t)rs->x_start[x] * 4;
+        uint32_t n = rs->x_end[x] - rs->x_start[x];
+
+        uint64_t r = 0, g = 0, b = 0;
+        uint32_t a = 0;
+        for (uint32_t i = 0; i < n; i++, px += 4)
+        {
+            uint32_t alpha = px[3];
+            r += px[0] * alpha;
+            g += px[1] * alpha;
+            b += px[2] * alpha;
+            a += alpha;
+        }
+
+        uint64_t divisor = (uint64_t)n * 255;
+        uint64_t half = (uint64_t)(n / 2) * 255;
+        int32_t alpha = (int32_t)((((uint64_t)a << 8) + n / 2) / n);
+        uint16_t *out = rs->hrow + x * 4;
+        out[0] = clamp_8_8(composite(rs, 0, (int32_t)(((r << 8) + half) / divisor), alpha));
+        out[1] = clamp_8_8(composite(rs, 1, (int32_t)(((g << 8) + half) / divisor), alpha));
+        out[2] = clamp_8_8(composite(rs, 2, (int32_t)(((b << 8) + half) / divisor), alpha));
+        out[3] = (uint16_t)alpha;
+    }
+}
+
+// Linear-light planes: span sums from the vector kernels
+static void reduce_samples_row(Resampler *rs, const unsigned char *row)
+{
+    const int c = rs->channels;
+    const uint16_t *light = split_samples(rs, row);
+
+    for (int x = 0; x < rs->dst_width; x++)
+    {
+        uint32_t n = rs->x_end[x] - rs->x_start[x];
+        uint64_t divisor = (uint64_t)n * LINEAR_MAX;
+        for (int k = 0; k < c; k++)
+        {
+            uint64_t sum = sum_samples(rs, light + (size_t)k * rs->src_width + rs->x_start[x], n);
+            rs->hrow[x * c + k] = clamp_8_8((int32_t)((sum * FULL_SCALE + divisor / 2) / divisor));
+        }
+    }
+}
+
+// Wide and linear-light sources: 16-bit samples, or bytes through the
+// linear table, scaled down to 8.8 and composited like above
+static void reduce_wide_row(Resampler *rs, const void *row)
+{
+    const int c = rs->channels;
+    const uint64_t max_value = rs->to_linear ? LINEAR_MAX : rs->max_value;
+
+    for (int x = 0; x < rs->dst_width; x++)
+    {
+        const size_t first = (size_t)rs->x_start[x] * c;
+        uint32_t n = rs->x_end[x] - rs->x_start[x];
+        int32_t value[4];
+
+        for (int k = 0; k < c; k++)
+        {
+            const uint16_t *lut = rs->to_linear ? linear_table(rs, k) : NULL;
+            const int weighted = rs->premultiply && k < 3;
+
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                size_t s = first + (size_t)i * c;
+                uint64_t v = source_sample(rs, row, s + k);
+                if (lut)
+                    v = lut[v];
+                if (weighted)
+                    v *= source_sample(rs, row, s + 3);
+                sum += v;
+            }
+
+            uint64_t divisor = n * max_value * (weighted ? rs->max_value : 1);
+            value[k] = (int32_t)((sum * FULL_SCALE + divisor / 2) / divisor);
+        }
+
+        for (int k = 0; k < c; k++)
+        {
+            int32_t v = rs->premultiply && k < 3 ? composite(rs, k, value[k], value[3]) : value[k];
+            rs->hrow[x * c + k] = clamp_8_8(v);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Lanczos: filter each row horizontally into the ring, then emit
+// every output row whose last tap has arrived
+// -------------------------------------------------------------
+static void lanczos_push_row(Resampler *rs, const void *row, int y)
+{
+    const int c = rs->channels;
+    const size_t samples = (size_t)rs->dst_width * c;
+    const int wide = rs->max_value > 255;
+    const int64_t max_value = rs->to_linear ? LINEAR_MAX : rs->max_value;
+
+    // 8.8 fixed point; negative lobes can push it below zero
+    int32_t *filtered = rs->ring + (size_t)(y % rs->y_taps) * samples;
+    const unsigned char *planes = rs->vector ? split_planes(rs, row) : NULL;
+    const uint16_t *split = rs->samples ? split_samples(rs, row) : NULL;
+    for (int x = 0; x < rs->dst_width; x++)
+    {
+        const int16_t *w = rs->x_weights + (size_t)x * rs->x_taps;
+        int32_t *out = filtered + x * c;
+
+        if (planes)
+        {
+            for (int k = 0; k < c; k++)
+            {
+                int32_t sum =
+                    rs->kernels->dot_u8(w, planes + (size_t)k * rs->src_width + rs->x_start[x], rs->x_taps);
+                out[k] = (sum + (1 << (WEIGHT_BITS - 9))) >> (WEIGHT_BITS - 8);
+            }
+        }
+        else if (split)
+        {
+            for (int k = 0; k < c; k++)
+            {
+                int32_t sum =
+                    rs->kernels->dot_u16(w, split + (size_t)k * rs->src_width + rs->x_start[x], rs->x_taps);
+                if (rs->to_linear)
+                    out[k] = (int32_t)(((int64_t)sum * FULL_SCALE / LINEAR_MAX) >> WEIGHT_BITS);
+                else
+                    out[k] = ((k < 3 ? sum / 255 : sum) + (1 << (WEIGHT_BITS - 9))) >> (WEIGHT_BITS - 8);
+            }
+        }
+        else
+        {
+            // 16-bit samples, or bytes in linear light without planes
+            const size_t first = (size_t)rs->x_start[x] * c;
+            for (int k = 0; k < c; k++)
+            {
+                const uint16_t *lut = rs->to_linear ? linear_table(rs, k) : NULL;
+                const int weighted = rs->premultiply && k < 3;
+
+                int64_t sum = 0;
+                for (int i = 0; i < rs->x_taps; i++)
+                {
+                    size_t s = first + (size_t)i * c;
+                    int64_t v = source_sample(rs, row, s + k);
+                    if (lut)
+                        v = lut[v];
+                    if (weighted)
+                        v *= source_sample(rs, row, s + 3);
+                    sum += w[i] * v;
+                }
+                out[k] = (int32_t)((sum * FULL_SCALE / (max_value * (weighted ? rs->max_value : 1))) >> WEIGHT_BITS);
+            }
+        }
+
+        if (rs->premultiply)
+        {
+            for (int k = 0; k < 3; k++)
+                out[k] = composite(rs, k, out[k], out[3]);
+        }
+    }
+
+    while (rs->dst_y < rs->dst_height && rs->y_start[rs->dst_y] + rs->y_taps - 1 == y)
+    {
+        const int first = rs->y_start[rs->dst_y];
+        const int16_t *w = rs->y_weights + (size_t)rs->dst_y * rs->y_taps;
+
+        for (size_t i = 0; i < samples; i++)
+        {
+            int64_t sum = 0;
+            for (int k = 0; k < rs->y_taps; k++)
+                sum += (int64_t)w[k] * rs->ring[(size_t)((first + k) % rs->y_taps) * samples + i];
+
+            if (rs->to_linear && !(c == 4 && i % 4 == 3))
+            {
+                int64_t v = (sum + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS;
+                rs->out_row[i] = linear_to_srgb(rs, (uint32_t)(v < 0 ? 0 : v > FULL_SCALE ? FULL_SCALE : v));
+                continue;
+            }
+
+            // Round, or for wide sources dither the fraction away
+            int64_t bias = (int64_t)1 << (WEIGHT_BITS + 7);
+            if (wide)
+                bias = (int64_t)(2 * bayer[rs->dst_y & 3][(i / c) & 3] + 1) << (WEIGHT_BITS + 8 - 5);
+            int64_t v = (sum + bias) >> (WEIGHT_BITS + 8);
+            rs->out_row[i] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+        }
+
+        rs->emit(rs->user, rs->out_row, rs->dst_width, c);
+        rs->dst_y++;
+    }
+}
+
+void resampler_set_background(Resampler *rs, const unsigned char *rgb)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        double c = rgb[k] / 255.0;
+        if (rs->to_linear)
+            c = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        rs->background[k] = (int32_t)lround(c * FULL_SCALE);
+    }
+}
+
+void resampler_push_row(Resampler *rs, const void *row)
+{
+    int y = rs->src_y++;
+    if (rs->dst_y >= rs->dst_height)
+        return;
+
+    if (rs->kernel == RESAMPLE_LANCZOS)
+    {
+        lanczos_push_row(rs, row, y);
+        return;
+    }
+
+    // Nearest skips the rows between the ones it samples
+    if (y < kernel_start(rs->kernel, rs->dst_y, rs->src_height, rs->dst_height))
+        return;
+
+    const size_t samples = (size_t)rs->dst_width * rs->channels;
+
+    const int wide = rs->max_value > 255;
+    if (rs->samples)
+        reduce_samples_row(rs, row);
+    else if (wide || rs->to_linear)
+        reduce_wide_row(rs, row);
+    else if (rs->premultiply)
+        reduce_premultiplied_row(rs, row);
+    else
+        reduce_row(rs, row);
+    rs->kernels->accumulate_u16(rs->accum, rs->hrow, samples);
+    rs->accum_rows++;
+
+    // Emit every output row whose span ends on this source row
+    while (rs->dst_y < rs->dst_height && kernel_end(rs->kernel, rs->dst_y, rs->src_height, rs->dst_height) - 1 == y)
+    {
+        uint32_t divisor = (uint32_t)rs->accum_rows << 8;
+        if (rs->to_linear)
+        {
+            for (size_t i = 0; i < samples; i++)
+            {
+                uint32_t v = (uint32_t)((((uint64_t)rs->accum[i] << 8) + divisor / 2) / divisor);
+                rs->out_row[i] = rs->channels == 4 && i % 4 == 3 ? (unsigned char)((v + 128) >> 8)
+                                                                 : linear_to_srgb(rs, v);
+            }
+        }
+        else if (wide)
+        {
+            // Dither the fraction away instead of rounding it
+            const unsigned char *thresholds = bayer[rs->dst_y & 3];
+            for (size_t i = 0; i < samples; i++)
+            {
+                uint32_t bias = (uint32_t)(((uint64_t)divisor * (2 * thresholds[(i / rs->channels) & 3] + 1)) >> 5);
+                rs->out_row[i] = (unsigned char)((rs->accum[i] + bias) / divisor);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < samples; i++)
+                rs->out_row[i] = (unsigned char)((rs->accum[i] + divisor / 2) / divisor);
+        }
+
+        rs->emit(rs->user, rs->out_row, rs->dst_width, rs->channels);
+        rs->dst_y++;
+
+        // Upscaling: the next output row reuses this same source row
+        if (rs->dst_y < rs->dst_height && kernel_start(rs->kernel, rs->dst_y, rs->src_height, rs->dst_height) <= y)
+            continue;
+
+        memset(rs->accum, 0, samples * sizeof(uint32_t));
+        rs->accum_rows = 0;
+    }
+}
+
+void resampler_reset(Resampler *rs)
+{
+    memset(rs->accum, 0, (size_t)rs->dst_width * rs->channels * sizeof(uint32_t));
+    rs->accum_rows = 0;
+    rs->src_y = 0;
+    rs->dst_y = 0;
+}
+
+void resampler_free(Resampler *rs)
+{
+    pool_free(rs->x_start);
+    pool_free(rs->x_end);
+    pool_free(rs->hrow);
+    pool_free(rs->accum);
+    pool_free(rs->out_row);
+    pool_free(rs->x_weights);
+    pool_free(rs->y_start);
+    pool_free(rs->y_weights);
+    pool_free(rs->ring);
+    pool_free(rs->to_linear);
+    pool_free(rs->to_srgb);
+    pool_free(rs->planes);
+    pool_free(rs->samples);
+    memset(rs, 0, sizeof(*rs));
+}
@@ -0,0 +1,89 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "kernels.h"
+#include <stdint.h>
+
+typedef void (*ResamplerEmitFn)(void *user, const unsigned char *row, int width, int channels);
+
+typedef enum {
+    RESAMPLE_BOX,     // Average of the covered source pixels
+    RESAMPLE_NEAREST, // One source pixel per output pixel
+    RESAMPLE_LANCZOS, // Lanczos-3, widened by the downscale factor
+} ResampleKernel;
+
+// Streaming resampler. Source rows are pushed one at a time; each output
+// row is emitted as soon as its last source row arrives, so memory is
+// O(width) no matter how tall the source is.
+typedef struct {
+    ResampleKernel kernel;
+    int src_width;
+    int src_height;
+    int dst_width;
+    int dst_height;
+    int channels;
+    int max_value; // Largest source sample: 255, or up to 65535 for wide rows
+
+    int src_y;      // Next source row expected
+    int dst_y;      // Next output row to emit
+    int accum_rows; // Source rows summed into accum so far
+
+    int *x_start;   // First source column of each output column
+    int *x_end;     // One past the last source column
+    uint16_t *hrow; // Horizontally reduced row, 8.8 fixed point
+    uint32_t *accum;
+    unsigned char *out_row;
+
+    // Lanczos: every output pixel reads a fixed number of taps from
+    // x_start / y_start on, with 2.14 fixed-point weights. Horizontally
+    // filtered rows wait in a ring that spans the vertical support.
+    int x_taps;
+    int16_t *x_weights;
+    int y_taps;
+    int *y_start;
+    int16_t *y_weights;
+    int32_t *ring;
+
+    // Linear light: samples go through to_linear (the sRGB curve, then a
+    // straight ramp for alpha) into 16-bit fixed point on the way in, and
+    // back through the 4096-entry to_srgb on the way out
+    uint16_t *to_linear;
+    unsigned char *to_srgb;
+
+    // RGBA: colors are averaged premultiplied by alpha and composited
+    // over background (8.8, in the same light as the samples). Alpha
+    // itself passes through, for callers that skip transparent cells.
+    int premultiply;
+    int32_t background[3];
+
+    // Lanczos over plain 8-bit rows runs its taps through the vector
+    // kernels, one channel plane at a time. 8-bit rows in linear light
+    // or with alpha are split into 16-bit planes first (looked up once
+    // per sample, premultiplied), which both kernels filter the same way.
+    const PixelKernels *kernels;
+    int vector;
+    unsigned char *planes; // Multi-channel rows, split per channel
+    uint16_t *samples;     // Linear-light or premultiplied rows, split per channel
+
+    ResamplerEmitFn emit;
+    void *user;
+} Resampler;
+
+// Source rows hold bits-bit samples: bytes for 8, uint16_t above that.
+// Output is always 8-bit; wide sources are ordered-dithered down to it
+// in the final rounding step only. With linear set, sRGB samples are
+// averaged as light rather than as gamma-encoded values.
+int resampler_init(Resampler *rs, ResampleKernel kernel, int src_width, int src_height, int dst_width, int dst_height,
+                   int channels, int bits, int linear, ResamplerEmitFn emit, void *user);
+// Composite RGBA sources over this color instead of black. Call after
+// resampler_init(), before the first row.
+void resampler_set_background(Resampler *rs, const unsigned char *rgb);
+void resampler_push_row(Resampler *rs, const void *row);
+// Start over from the first source row, e.g. for the next progressive scan
+void resampler_reset(Resampler *rs);
+void resampler_free(Resampler *rs);
+// Bytes of filtered rows Lanczos keeps in its ring: one row per vertical
+// tap, and the taps grow with the downscale ratio
+size_t resampler_ring_bytes(int src_height, int dst_width, int dst_height, int channels);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef ROW_SINK_H
+#define ROW_SINK_H
+
+#include <stddef.h>
+
+// Source rectangle in image pixels. A zero width or height means the
+// whole image.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} Region;
+
+// Speed/quality trade-off, from --quality
+typedef enum {
+    QUALITY_BALANCED, // Accurate decode, box filtering, truecolor
+    QUALITY_FAST,     // Fast IDCT and upsampling, nearest, 256 colors
+    QUALITY_BEST,     // Accurate decode everywhere, Lanczos
+} Quality;
+
+// What to decode, shared by every decoder
+typedef struct {
+    Region crop;
+    Quality quality;
+    size_t max_memory; // Bytes of image buffers a decode may hold, 0 = no limit
+    int linear;        // Rows are resampled in linear light; don't average them here
+    void *turbojpeg;   // TurboJPEG decompressor (tjhandle) to reuse, NULL = one per call
+} DecodeOptions;
+
+// Decoders push pixel rows, top to bottom, into a RowSink instead of
+// returning a whole image, so nothing downstream needs a full frame.
+typedef struct {
+    // Called with the (cropped) source size before decoding starts and
+    // fills in the output size, so decoders can pick a reduced-size decode.
+    void (*plan)(void *user, int width, int height, int *out_width, int *out_height);
+    // Called once the decoded dimensions are known, before any row.
+    // Returns non-zero to abort decoding.
+    int (*begin)(void *user, int width, int height, int channels);
+    // Optional alternative to begin() for palette images: rows then carry
+    // one palette index per pixel. palette holds 256 RGBA entries.
+    // NULL if the sink only takes full pixels.
+    int (*begin_indexed)(void *user, int width, int height, const unsigned char *palette);
+    // Optional alternative to begin() for sources deeper than 8 bits: rows
+    // then carry width * channels uint16_t samples in host byte order, of
+    // which the low bits are used. NULL if the sink only takes bytes.
+    int (*begin_wide)(void *user, int width, int height, int channels, int bits);
+    // Called once per source row with width * channels bytes, width
+    // indices after begin_indexed(), or 16-bit samples after begin_wide().
+    void (*row)(void *user, const unsigned char *pixels);
+    void *user;
+} RowSink;
+
+// Coarse-to-fine decoding (progressive JPEG scans, Adam7 passes): every
+// refinement is pushed through the sink as a full frame.
+typedef struct {
+    // Stop after the first frame that completes past this budget, 0 = none
+    int time_budget_ms;
+    // Called after every frame. The sink then receives the next frame's
+    // rows from the top again.
+    void (*frame_done)(void *user, int frame);
+    void *user;
+} RefineOptions;
+
+// Our own accounting for the large buffers a decode is about to allocate
+static inline int exceeds_budget(const DecodeOptions *decode, size_t bytes)
+{
+    return decode->max_memory > 0 && bytes > decode->max_memory;
+}
+
+// Clip a crop region to the image; an empty region selects everything.
+// Returns non-zero if the region lies entirely outside the image.
+static inline int region_clamp(Region *region, int width, int height)
+{
+    if (region->width <= 0 || region->height <= 0)
+    {
+        *region = (Region){0, 0, width, height};
+        return 0;
+    }
+
+    if (region->x < 0 || region->y < 0 || region->x >= width || region->y >= height)
+        return 1;
+    if (region->width > width - region->x)
+        region->width = width - region->x;
+    if (region->height > height - region->y)
+        region->height = height - region->y;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "stats.h"
+#include "pool.h"
+#include "timing.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *const stage_names[STATS_STAGES] = {"read", "decode", "resample", "render", "write"};
+
+int stats_enabled;
+uint64_t stats_counters[STATS_COUNTERS];
+
+static uint64_t stage_ns[STATS_STAGES];
+static double start_ms;
+
+// Each thread has its own current stage and the time it became current
+static _Thread_local int current_stage = -1;
+static _Thread_local uint64_t current_since;
+
+// Hardware counters: cycles and cache misses, -1 when unavailable
+static int cycles_fd = -1;
+static int misses_fd = -1;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int stats_switch(int stage)
+{
+    uint64_t now = now_ns();
+    int previous = current_stage;
+    if (previous >= 0)
+        __atomic_fetch_add(&stage_ns[previous], now - current_since, __ATOMIC_RELAXED);
+    current_stage = stage;
+    current_since = now;
+    return previous;
+}
+
+#ifdef __linux__
+// -------------------------------------------------------------
+// Helper: Count a hardware event in user space across this process
+// and the threads it starts. Fails under a strict perf_event_paranoid
+// or in containers that filter the syscall; the stats just say so.
+// -------------------------------------------------------------
+static int open_counter(uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void stats_start(void)
+{
+#ifdef __linux__
+    cycles_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+    misses_fd = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+#endif
+    start_ms = monotonic_ms();
+    stats_enabled = 1;
+}
+
+// Read (and close) one hardware counter; 0 when it isn't available
+static int read_counter(int *fd, uint64_t *value)
+{
+    int ok = 0;
+#ifndef _WIN32
+    if (*fd >= 0)
+    {
+        ok = read(*fd, value, sizeof(*value)) == sizeof(*value);
+        close(*fd);
+        *fd = -1;
+    }
+#else
+    (void)fd;
+    (void)value;
+#endif
+    return ok;
+}
+
+// Peak resident set size in bytes, 0 if unknown
+static uint64_t peak_rss(void)
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+        return (uint64_t)usage.ru_maxrss;
+#else
+        return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+    return 0;
+}
+
+void stats_report(FILE *out, int json)
+{
+    if (!stats_enabled)
+        return;
+
+    // Close out the running stage so its time counts
+    stats_switch(-1);
+    double wall_ms = monotonic_ms() - start_ms;
+
+    uint64_t cycles = 0, misses = 0;
+    int have_cycles = read_counter(&cycles_fd, &cycles);
+    int have_misses = read_counter(&misses_fd, &misses);
+    uint64_t rss = peak_rss();
+    PoolStats pool;
+    pool_stats(&pool);
+
+    double ms[STATS_STAGES];
+    for (int s = 0; s < STATS_STAGES; s++)
+        ms[s] = stage_ns[s] / 1e6;
+    const uint64_t *c = stats_counters;
+
+    if (json)
+    {
+        fprintf(out, "{\"wall_ms\": %.3f, \"stages\": {", wall_ms);
+        for (int s = 0; s < STATS_STAGES; s++)
+        {
+            fprintf(out, "%s\"%s\": {\"ms\": %.3f", s ? ", " : "", stage_names[s], ms[s]);
+            if (s == STATS_READ)
+                fprintf(out, ", \"bytes\": %llu", (unsigned long long)c[STATS_BYTES_READ]);
+            else if (s == STATS_RENDER)
+                fprintf(out, ", \"sgr\": %llu, \"cells_skipped\": %llu", (unsigned long long)c[STATS_SGR],
+                        (unsigned long long)c[STATS_CELLS_SKIPPED]);
+            else if (s == STATS_WRITE)
+                fprintf(out, ", \"bytes\": %llu", (unsigned long long)c[STATS_BYTES_WRITTEN]);
+            fprintf(out, "}");
+        }
+        fprintf(out, "}, \"peak_rss_bytes\": %llu, \"pool\": {\"allocations\": %zu, \"cache_hits\": %zu}",
+                (unsigned long long)rss, pool.allocations, pool.cache_hits);
+        if (have_cycles)
+            fprintf(out, ", \"cycles\": %llu", (unsigned long long)cycles);
+        else
+            fprintf(out, ", \"cycles\": null");
+        if (have_misses)
+            fprintf(out, ", \"cache_misses\": %llu", (unsigned long long)misses);
+        else
+            fprintf(out, ", \"cache_misses\": null");
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, "Stats (%.2f ms wall, stage times summed over threads):\n", wall_ms);
+    fprintf(out, "  read     %9.2f ms  %llu bytes\n", ms[STATS_READ], (unsigned long long)c[STATS_BYTES_READ]);
+    fprintf(out, "  decode   %9.2f ms\n", ms[STATS_DECODE]);
+    fprintf(out, "  resample %9.2f ms\n", ms[STATS_RESAMPLE]);
+    fprintf(out, "  render   %9.2f ms  %llu SGR escapes, %llu cells skipped\n", ms[STATS_RENDER],
+            (unsigned long long)c[STATS_SGR], (unsigned long long)c[STATS_CELLS_SKIPPED]);
+    fprintf(out, "  write    %9.2f ms  %llu bytes\n", ms[STATS_WRITE], (unsigned long long)c[STATS_BYTES_WRITTEN]);
+    fprintf(out, "  memory   peak RSS %.1f MiB, %zu pool allocations (%zu from the cache)\n", rss / 1048576.0,
+            pool.allocations, pool.cache_hits);
+    if (!have_cycles && !have_misses)
+    {
+        fprintf(out, "  cpu      hardware counters unavailable\n");
+        return;
+    }
+    fprintf(out, "  cpu     ");
+    if (have_cycles)
+        fprintf(out, " %llu cycles", (unsigned long long)cycles);
+    if (have_misses)
+        fprintf(out, "%s %llu cache misses", have_cycles ? "," : "", (unsigned long long)misses);
+    fprintf(out, "\n");
+}
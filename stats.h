@@ -0,0 +1,55 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Where time goes. Stages nest (decoding calls into resampling, which
+// calls into rendering...); time is charged to the innermost one.
+typedef enum {
+    STATS_READ,
+    STATS_DECODE,
+    STATS_RESAMPLE,
+    STATS_RENDER,
+    STATS_WRITE,
+    STATS_STAGES,
+} StatsStage;
+
+typedef enum {
+    STATS_BYTES_READ,
+    STATS_BYTES_WRITTEN,
+    STATS_SGR,           // Color escapes written
+    STATS_CELLS_SKIPPED, // Left to the terminal by sparse output
+    STATS_COUNTERS,
+} StatsCounter;
+
+// Everything below is a test of this flag until stats_start()
+extern int stats_enabled;
+extern uint64_t stats_counters[STATS_COUNTERS];
+
+int stats_switch(int stage);
+
+// Make stage the current one on this thread; returns the stage to hand
+// back to stats_leave() when it's done
+static inline int stats_enter(StatsStage stage)
+{
+    return stats_enabled ? stats_switch(stage) : -1;
+}
+
+static inline void stats_leave(int previous)
+{
+    if (stats_enabled)
+        stats_switch(previous);
+}
+
+static inline void stats_add(StatsCounter counter, uint64_t amount)
+{
+    if (stats_enabled)
+        __atomic_fetch_add(&stats_counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+// Start collecting, including hardware counters where the kernel allows
+void stats_start(void);
+void stats_report(FILE *out, int json);
+
+#endif
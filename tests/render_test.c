@@ -0,0 +1,407 @@
+// Rendering tests: what ends up on screen, checked through a minimal
+// terminal that understands the escapes the renderer emits.
+//
+// Run from the repository root; see "Tests" in README.md.
+
+#include "png_handler.h"
+#include "render.h"
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(condition)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(condition))                                                                                              \
+        {                                                                                                              \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #condition);              \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+// -------------------------------------------------------------
+// Screen: cells painted by full blocks, cursor motion, save and
+// restore, erase below. '\n' returns to the first column, as it
+// does through a tty with onlcr.
+// -------------------------------------------------------------
+#define SCREEN_COLUMNS 64
+#define SCREEN_ROWS 32
+
+typedef struct {
+    unsigned char rgb[SCREEN_ROWS][SCREEN_COLUMNS][3];
+    unsigned char painted[SCREEN_ROWS][SCREEN_COLUMNS];
+    int x, y;
+    int saved_x, saved_y;
+    unsigned char fg[3];
+} Screen;
+
+static void erase_below(Screen *screen)
+{
+    for (int y = screen->y; y < SCREEN_ROWS; y++)
+        for (int x = y == screen->y ? screen->x : 0; x < SCREEN_COLUMNS; x++)
+            screen->painted[y][x] = 0;
+}
+
+static void screen_feed(Screen *screen, const char *text, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)text, *end = p + length;
+    while (p < end)
+    {
+        if (p[0] == 0x1b && p + 1 < end && (p[1] == '7' || p[1] == '8'))
+        {
+            if (p[1] == '7')
+            {
+                screen->saved_x = screen->x;
+                screen->saved_y = screen->y;
+            }
+            else
+            {
+                screen->x = screen->saved_x;
+                screen->y = screen->saved_y;
+            }
+            p += 2;
+        }
+        else if (p[0] == 0x1b && p + 1 < end && p[1] == '[')
+        {
+            int params[8] = {0}, count = 0;
+            p += 2;
+            while (p < end && ((*p >= '0' && *p <= '9') || *p == ';'))
+            {
+                if (*p == ';')
+                    count++;
+                else if (count < 8)
+                    params[count] = params[count] * 10 + (*p - '0');
+                p++;
+            }
+            count++;
+            int n = params[0] > 0 ? params[0] : 1;
+            switch (p < end ? *p : 0)
+            {
+            case 'A':
+                screen->y = screen->y >= n ? screen->y - n : 0;
+                break;
+            case 'C':
+                screen->x += n;
+                break;
+            case 'G':
+                screen->x = n - 1;
+                break;
+            case 'J':
+                erase_below(screen);
+                break;
+            case 'm':
+                if (count >= 5 && params[0] == 38 && params[1] == 2)
+                    for (int k = 0; k < 3; k++)
+                        screen->fg[k] = (unsigned char)params[2 + k];
+                break;
+            }
+            p++;
+        }
+        else if (p[0] == '\r')
+        {
+            screen->x = 0;
+            p++;
+        }
+        else if (p[0] == '\n')
+        {
+            screen->x = 0;
+            screen->y++;
+            p++;
+        }
+        else if (p[0] == ' ' || (p + 2 < end && memcmp(p, "\xe2\x96\x88", 3) == 0))
+        {
+            int block = p[0] != ' ';
+            if (screen->x < SCREEN_COLUMNS && screen->y < SCREEN_ROWS)
+            {
+                screen->painted[screen->y][screen->x] = (unsigned char)block;
+                memcpy(screen->rgb[screen->y][screen->x], screen->fg, 3);
+            }
+            screen->x++;
+            p += block ? 3 : 1;
+        }
+        else
+        {
+            p++;
+        }
+    }
+}
+
+static int screen_write(void *user, const char *text, size_t length)
+{
+    screen_feed(user, text, length);
+    return 0;
+}
+
+// Rows painted from the top, stopping at the first empty one
+static int screen_rows(const Screen *screen)
+{
+    int rows = 0;
+    while (rows < SCREEN_ROWS && memchr(screen->painted[rows], 1, SCREEN_COLUMNS))
+        rows++;
+    return rows;
+}
+
+// The screen shows exactly grid, from the top left corner
+static int screen_shows(const Screen *screen, const CellGrid *grid)
+{
+    if (screen_rows(screen) != grid->rows)
+        return 0;
+    for (int y = 0; y < grid->rows; y++)
+        for (int x = 0; x < SCREEN_COLUMNS; x++)
+        {
+            int inside = x < grid->columns;
+            if (screen->painted[y][x] != inside)
+                return 0;
+            if (inside && memcmp(screen->rgb[y][x], grid->rgb + ((size_t)y * grid->columns + x) * 3, 3) != 0)
+                return 0;
+        }
+    return 1;
+}
+
+static void fill_grid(CellGrid *grid, int seed)
+{
+    for (size_t i = 0; i < (size_t)grid->columns * grid->rows * 3; i++)
+        grid->rgb[i] = (unsigned char)(i * 7 + seed * 31 + 1);
+}
+
+// -------------------------------------------------------------
+// Refinement redraws in place, over the preview
+// -------------------------------------------------------------
+
+// Draw shown as the preview does, refine it to next, and check that only
+// next is left on screen
+static void refine(int columns, int rows, int next_columns, int next_rows)
+{
+    Screen *screen = calloc(1, sizeof(Screen));
+    RenderOutput out = {.write = screen_write, .user = screen};
+    RenderOptions options = {.colors = COLOR_TRUECOLOR};
+    Renderer renderer;
+    CellGrid shown, next;
+    int wide = columns > next_columns ? columns : next_columns;
+    if (screen == NULL || renderer_init(&renderer, &out, wide, &options) || cell_grid_init(&shown, columns, rows) ||
+        cell_grid_init(&next, next_columns, next_rows))
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_grid(&shown, 1);
+    fill_grid(&next, 2);
+
+    render_grid(&renderer, &shown);
+    render_output_write(&out, "\x1b" "7", 2);
+    CHECK(screen_shows(screen, &shown));
+
+    size_t redrawn = render_grid_diff(&renderer, &shown, &next);
+    CHECK(screen_shows(screen, &next));
+    CHECK(redrawn > 0 && redrawn <= (size_t)next_columns * next_rows);
+
+    // The saved position is below the new grid, ready for another diff
+    screen_feed(screen, "\x1b" "8", 2);
+    CHECK(screen->y == next_rows && screen->x == 0);
+
+    cell_grid_free(&shown);
+    cell_grid_free(&next);
+    renderer_free(&renderer);
+    free(screen);
+}
+
+static void test_refine_same_size(void)
+{
+    refine(12, 6, 12, 6);
+}
+
+static void test_refine_taller(void)
+{
+    refine(12, 4, 12, 7);
+}
+
+static void test_refine_smaller(void)
+{
+    refine(12, 7, 9, 3);
+}
+
+// -------------------------------------------------------------
+// Palette images render from pre-built cells
+// -------------------------------------------------------------
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} PngBuffer;
+
+static void png_buffer_write(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    PngBuffer *buffer = png_get_io_ptr(png_ptr);
+    if (buffer->size + length > buffer->capacity)
+    {
+        buffer->capacity = (buffer->size + length) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL)
+            png_error(png_ptr, "Out of memory");
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+}
+
+static void png_buffer_flush(png_structp png_ptr)
+{
+    (void)png_ptr;
+}
+
+#define PALETTE_COLORS 16
+
+// Neighbouring rows run the palette in opposite directions, so merging
+// them makes colors the palette doesn't have
+static unsigned char palette_index(int x, int y)
+{
+    return (unsigned char)((y & 1 ? PALETTE_COLORS - 1 - x : x) % PALETTE_COLORS);
+}
+
+static void palette_color(int index, unsigned char *rgb)
+{
+    rgb[0] = (unsigned char)(index * 16);
+    rgb[1] = (unsigned char)(255 - index * 16);
+    rgb[2] = (unsigned char)(index * 5 + 40);
+}
+
+// An 8-bit PNG whose pixels are palette_color(palette_index(x, y)),
+// stored as palette indices or as RGB
+static PngBuffer palette_png(int width, int height, int indexed)
+{
+    PngBuffer buffer = {0};
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    unsigned char *row = malloc((size_t)width * 3);
+    if (png_ptr == NULL || info_ptr == NULL || row == NULL || setjmp(png_jmpbuf(png_ptr)))
+    {
+        fprintf(stderr, "Couldn't write test PNG.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    png_color palette[PALETTE_COLORS];
+    for (int i = 0; i < PALETTE_COLORS; i++)
+    {
+        unsigned char rgb[3];
+        palette_color(i, rgb);
+        palette[i] = (png_color){rgb[0], rgb[1], rgb[2]};
+    }
+
+    png_set_write_fn(png_ptr, &buffer, png_buffer_write, png_buffer_flush);
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, indexed ? PNG_COLOR_TYPE_PALETTE : PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    if (indexed)
+        png_set_PLTE(png_ptr, info_ptr, palette, PALETTE_COLORS);
+    png_write_info(png_ptr, info_ptr);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (indexed)
+                row[x] = palette_index(x, y);
+            else
+                palette_color(palette_index(x, y), row + x * 3);
+        }
+        png_write_row(png_ptr, row);
+    }
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    free(row);
+    return buffer;
+}
+
+// Render a PNG 16 columns wide with the default 1:2 cells; table says
+// whether the palette cell path drew it
+static Screen *render_png(const PngBuffer *png, ResampleKernel kernel, size_t max_memory, int *table)
+{
+    Screen *screen = calloc(1, sizeof(Screen));
+    RenderOutput out = {.write = screen_write, .user = screen};
+    RenderOptions options = {.width = 16, .colors = COLOR_TRUECOLOR, .kernel = kernel, .max_memory = max_memory};
+    DecodeOptions decode = {0};
+    RenderPipeline pipeline;
+    if (screen == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    render_pipeline_init(&pipeline, &options, &out);
+    RowSink sink = render_pipeline_sink(&pipeline);
+
+    CHECK(decode_png(png->data, png->size, &decode, &sink) == 0);
+    *table = pipeline.indexed && pipeline.cells != NULL;
+    render_pipeline_free(&pipeline);
+    return screen;
+}
+
+// A palette image looks the same as its RGB copy: box filtering merges
+// its rows like any others, and only the nearest kernel, which never
+// merges pixels, takes the palette cell path
+static void palette_matches_rgb(ResampleKernel kernel, int expect_table)
+{
+    const int width = 16, height = 20;
+    PngBuffer indexed = palette_png(width, height, 1), rgb = palette_png(width, height, 0);
+    int table, rgb_table;
+    Screen *from_palette = render_png(&indexed, kernel, 0, &table);
+    Screen *from_rgb = render_png(&rgb, kernel, 0, &rgb_table);
+
+    CHECK(table == expect_table && !rgb_table);
+    CHECK(screen_rows(from_palette) == height / 2);
+    CHECK(memcmp(from_palette->painted, from_rgb->painted, sizeof(from_rgb->painted)) == 0);
+    CHECK(memcmp(from_palette->rgb, from_rgb->rgb, sizeof(from_rgb->rgb)) == 0);
+
+    free(from_palette);
+    free(from_rgb);
+    free(indexed.data);
+    free(rgb.data);
+}
+
+static void test_palette_box(void)
+{
+    palette_matches_rgb(RESAMPLE_BOX, 0);
+}
+
+static void test_palette_nearest(void)
+{
+    palette_matches_rgb(RESAMPLE_NEAREST, 1);
+}
+
+// A steep downscale needs hundreds of Lanczos taps, each a row of the
+// ring. Over the budget the render falls back to box filtering.
+static void test_lanczos_budget(void)
+{
+    PngBuffer png = palette_png(512, 512, 0);
+    int table;
+    Screen *lanczos = render_png(&png, RESAMPLE_LANCZOS, 0, &table);
+    Screen *budget = render_png(&png, RESAMPLE_LANCZOS, 64 << 10, &table);
+    Screen *box = render_png(&png, RESAMPLE_BOX, 0, &table);
+
+    CHECK(resampler_ring_bytes(512, 16, 8, 4) > 64 << 10);
+    CHECK(screen_rows(budget) == 8);
+    CHECK(memcmp(budget->rgb, box->rgb, sizeof(box->rgb)) == 0);
+    CHECK(memcmp(lanczos->rgb, box->rgb, sizeof(box->rgb)) != 0);
+
+    free(lanczos);
+    free(budget);
+    free(box);
+    free(png.data);
+}
+
+int main(void)
+{
+    test_refine_same_size();
+    test_refine_taller();
+    test_refine_smaller();
+    test_palette_box();
+    test_palette_nearest();
+    test_lanczos_budget();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All render tests passed.\n");
+    return EXIT_SUCCESS;
+}
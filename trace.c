@@ -0,0 +1,159 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Events per chunk; a thread that fills one chains on another
+#define TRACE_CHUNK_EVENTS 4096
+
+typedef struct {
+    const char *name;
+    uint64_t start; // ns since trace_start()
+    uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceChunk {
+    struct TraceChunk *next;
+    int count;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+// One per thread. Only its owner appends; the list of them only grows.
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int tid;
+    const char *name;
+    TraceChunk *first;
+    TraceChunk *last;
+    int dropped; // Out of memory: events lost rather than a failed render
+} TraceBuffer;
+
+int trace_enabled;
+
+static uint64_t origin;
+static TraceBuffer *buffers;
+static int next_tid;
+static _Thread_local TraceBuffer *own;
+
+uint64_t trace_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// -------------------------------------------------------------
+// Helper: The calling thread's buffer, created and published with a
+// compare-and-swap on first use
+// -------------------------------------------------------------
+static TraceBuffer *thread_buffer(void)
+{
+    if (own)
+        return own;
+
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL)
+        return NULL;
+    buffer->tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+
+    buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    own = buffer;
+    return buffer;
+}
+
+void trace_record(const char *name, uint64_t start)
+{
+    uint64_t end = trace_clock();
+    TraceBuffer *buffer = thread_buffer();
+    if (buffer == NULL)
+        return;
+
+    TraceChunk *chunk = buffer->last;
+    if (chunk == NULL || chunk->count == TRACE_CHUNK_EVENTS)
+    {
+        TraceChunk *fresh = malloc(sizeof(TraceChunk));
+        if (fresh == NULL)
+        {
+            buffer->dropped++;
+            return;
+        }
+        fresh->next = NULL;
+        fresh->count = 0;
+        if (chunk)
+            chunk->next = fresh;
+        else
+            buffer->first = fresh;
+        buffer->last = chunk = fresh;
+    }
+
+    chunk->events[chunk->count++] = (TraceEvent){name, start - origin, end - start};
+}
+
+void trace_name_thread(const char *name)
+{
+    TraceBuffer *buffer = trace_enabled ? thread_buffer() : NULL;
+    if (buffer)
+        buffer->name = name;
+}
+
+void trace_start(void)
+{
+    origin = trace_clock();
+    trace_enabled = 1;
+    trace_name_thread("main");
+}
+
+int trace_write(const char *path)
+{
+    trace_enabled = 0;
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        fprintf(stderr, "Couldn't open '%s' for writing.\n", path);
+
+    // Timestamps and durations are in microseconds
+    int first = 1;
+    if (out)
+        fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    TraceBuffer *buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+    while (buffer)
+    {
+        if (out && buffer->name)
+        {
+            fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",", buffer->tid, buffer->name);
+            first = 0;
+        }
+
+        TraceChunk *chunk = buffer->first;
+        while (chunk)
+        {
+            for (int i = 0; out && i < chunk->count; i++)
+            {
+                const TraceEvent *event = &chunk->events[i];
+                fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        first ? "" : ",", event->name, buffer->tid, event->start / 1e3, event->duration / 1e3);
+                first = 0;
+            }
+            TraceChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+
+        if (buffer->dropped > 0)
+            fprintf(stderr, "Trace: %d events dropped for lack of memory.\n", buffer->dropped);
+
+        TraceBuffer *next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    buffers = NULL;
+
+    if (out == NULL)
+        return 1;
+    fprintf(out, "\n]}\n");
+    return fclose(out) != 0;
+}
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Timeline of scoped spans in the Chrome trace event format, for viewing
+// in Perfetto or chrome://tracing. Each thread appends to its own buffer
+// without locks; the buffers are only read by trace_write().
+//
+//     uint64_t span = trace_begin();
+//     ...
+//     trace_end("png_read_row", span);
+//
+// Names must be string literals (they're stored by pointer).
+
+extern int trace_enabled;
+
+uint64_t trace_clock(void);
+void trace_record(const char *name, uint64_t start);
+
+static inline uint64_t trace_begin(void)
+{
+    return trace_enabled ? trace_clock() : 0;
+}
+
+static inline void trace_end(const char *name, uint64_t start)
+{
+    if (trace_enabled)
+        trace_record(name, start);
+}
+
+// Label the calling thread's track
+void trace_name_thread(const char *name);
+
+void trace_start(void);
+// Once every traced thread has finished. Returns non-zero on error.
+int trace_write(const char *path);
+
+#endif
@@ -0,0 +1,271 @@
+#include "vishellize.h"
+#include "input.h"
+#include "jpeg_handler.h"
+#include "png_handler.h"
+#include "preview.h"
+#include "render.h"
+#include "stats.h"
+#include "trace.h"
+#include "vzc.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <turbojpeg.h>
+
+struct Vishellize {
+    tjhandle turbojpeg; // Lent to every JPEG decode; NULL = each makes its own
+    FILE *log;
+};
+
+Vishellize *vishellize_create(void)
+{
+    Vishellize *context = calloc(1, sizeof(Vishellize));
+    if (context == NULL)
+        return NULL;
+
+    context->turbojpeg = tj3Init(TJINIT_DECOMPRESS);
+    return context;
+}
+
+void vishellize_destroy(Vishellize *context)
+{
+    if (context == NULL)
+        return;
+    if (context->turbojpeg)
+        tj3Destroy(context->turbojpeg);
+    free(context);
+}
+
+void vishellize_set_log(Vishellize *context, FILE *log)
+{
+    context->log = log;
+}
+
+static void note(const Vishellize *context, const char *restrict format, ...)
+{
+    if (context->log == NULL)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(context->log, format, args);
+    va_end(args);
+}
+
+// -------------------------------------------------------------
+// Helper: Split the options between decoder and renderer. The
+// quality preset picks the decoder's IDCT and upsampling, the
+// resampling kernel, the color depth (unless given) and how to
+// dither below truecolor.
+// -------------------------------------------------------------
+static void split_options(const Vishellize *context, const VishellizeOptions *options, DecodeOptions *decode,
+                          RenderOptions *render)
+{
+    memset(decode, 0, sizeof(*decode));
+    memset(render, 0, sizeof(*render));
+
+    decode->crop = (Region){options->crop.x, options->crop.y, options->crop.width, options->crop.height};
+    decode->max_memory = options->max_memory;
+    decode->linear = options->linear;
+    decode->turbojpeg = context->turbojpeg;
+
+    render->width = options->width;
+    render->colors = options->colors == VISHELLIZE_256_COLORS ? COLOR_256 : COLOR_TRUECOLOR;
+    render->linear = options->linear;
+    memcpy(render->background, options->background, 3);
+    render->sparse = options->sparse;
+    render->tolerance = options->tolerance;
+    render->cell_width = options->cell_width;
+    render->cell_height = options->cell_height;
+    render->max_memory = options->max_memory;
+
+    switch (options->quality)
+    {
+    case VISHELLIZE_FAST:
+        decode->quality = QUALITY_FAST;
+        render->kernel = RESAMPLE_NEAREST;
+        if (options->colors == VISHELLIZE_PRESET_COLORS)
+            render->colors = COLOR_256;
+        render->dither = DITHER_NONE;
+        break;
+    case VISHELLIZE_BALANCED:
+        decode->quality = QUALITY_BALANCED;
+        render->kernel = RESAMPLE_BOX;
+        render->dither = DITHER_ORDERED;
+        break;
+    case VISHELLIZE_BEST:
+        decode->quality = QUALITY_BEST;
+        render->kernel = RESAMPLE_LANCZOS;
+        render->dither = DITHER_ORDERED;
+        break;
+    }
+}
+
+// -------------------------------------------------------------
+// Helper: Replay a .vzc cell grid, or copy it through when cells
+// are what's asked for
+// -------------------------------------------------------------
+static int replay_cells(const InputBuffer *input, const VishellizeOptions *options, const RenderOptions *render,
+                        RenderOutput *out)
+{
+    VzcImage image;
+    if (vzc_open(input->data, input->size, &image))
+        return 1;
+
+    if (options->output == VISHELLIZE_CELLS)
+    {
+        render_output_write(out, (const char *)input->data, image.size);
+        return 0;
+    }
+    return vzc_render(&image, render, out);
+}
+
+// -------------------------------------------------------------
+// Helper: Decode and render one image. With file set, input holds
+// the head of the stream and the decoder reads the rest from it.
+// -------------------------------------------------------------
+static VishellizeStatus render_input(Vishellize *context, InputBuffer *input, FILE *file,
+                                     const VishellizeOptions *options, RenderOutput *out)
+{
+    DecodeOptions decode;
+    RenderOptions render;
+    split_options(context, options, &decode, &render);
+
+    VishellizeStatus status = VISHELLIZE_OK;
+    int failed = 0;
+
+    // Cells are captured into the pipeline's grid and saved at the end
+    int cells = options->output == VISHELLIZE_CELLS;
+    VishellizeRefine refine = cells ? VISHELLIZE_ONCE : options->refine;
+
+    RenderPipeline pipeline;
+    render_pipeline_init(&pipeline, &render, out);
+    pipeline.capture = cells;
+    RowSink sink = render_pipeline_sink(&pipeline);
+
+    // Detect file type by magic bytes
+    ImageFormat format = detect_format(input->data, input->size);
+    int stage = stats_enter(STATS_DECODE);
+    uint64_t span = trace_begin();
+
+    // Lossless JPEGs are decoded by TurboJPEG from one contiguous buffer
+    if (format == FORMAT_JPEG && !input->complete && jpeg_lossless(input->data, input->size, &decode) &&
+        input_read_rest(file, input))
+    {
+        failed = 1;
+    }
+    else if (format == FORMAT_VZC)
+    {
+        // Already rendered: nothing to decode or resample
+        failed = input_read_rest(file, input) || replay_cells(input, options, &render, out);
+    }
+    else if (refine == VISHELLIZE_PROGRESSIVE && (format == FORMAT_PNG || format == FORMAT_JPEG))
+    {
+        // PNG passes are decoded from one contiguous buffer
+        PreviewStats stats = {0};
+        FILE *rest = input->complete ? NULL : file;
+        failed = (format == FORMAT_PNG && input_read_rest(file, input)) ||
+                 render_refined(format, input->data, input->size, rest, &decode, &render, options->time_budget_ms,
+                                out, &stats);
+
+        note(context, "Time to first image: %.1f ms, %d refinements shown after %.1f ms (%zu cells redrawn)\n",
+             stats.first_image_ms, stats.frames, stats.final_ms, stats.cells_redrawn);
+    }
+    else if (format == FORMAT_PNG)
+    {
+        // Streams are decoded as they arrive rather than buffered whole
+        failed = input->complete ? decode_png(input->data, input->size, &decode, &sink)
+                                 : decode_png_stream(file, input->data, input->size, &decode, &sink);
+        if (failed)
+            fprintf(stderr, "Failed to load PNG image.\n");
+    }
+    else if (format == FORMAT_JPEG && refine == VISHELLIZE_PREVIEW)
+    {
+        // Both stages decode from one contiguous buffer
+        PreviewStats stats = {0};
+        failed = input_read_rest(file, input) ||
+                 render_jpeg_refined(input->data, input->size, &decode, &render, out, &stats);
+
+        note(context, "Time to first image: %.1f ms, refined after %.1f ms (%zu cells redrawn)\n",
+             stats.first_image_ms, stats.final_ms, stats.cells_redrawn);
+    }
+    else if (format == FORMAT_JPEG)
+    {
+        failed = input->complete ? decode_jpeg(input->data, input->size, &decode, &sink)
+                                 : decode_jpeg_stream(file, input->data, input->size, &decode, &sink);
+    }
+    else
+    {
+        fprintf(stderr, "Unsupported file format.\n");
+        status = VISHELLIZE_UNSUPPORTED;
+    }
+
+    if (cells && pipeline.started && !failed)
+        failed = vzc_write(out, &pipeline.grid, render.background);
+    render_pipeline_free(&pipeline);
+    trace_end("image", span);
+    stats_leave(stage);
+
+    if (failed)
+        status = VISHELLIZE_FAILED;
+    else if (out->failed)
+        status = VISHELLIZE_WRITE_FAILED;
+    return status;
+}
+
+VishellizeStatus vishellize_render(Vishellize *context, const void *data, size_t size, const VishellizeOptions *options,
+                                   VishellizeWriteFn write, void *user)
+{
+    InputBuffer input = {.data = data, .size = size, .capacity = size, .complete = 1};
+    RenderOutput out = {.write = write, .user = user};
+    return render_input(context, &input, NULL, options, &out);
+}
+
+// -------------------------------------------------------------
+// Buffer output: keep what fits, count the rest
+// -------------------------------------------------------------
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t length;
+} BufferWriter;
+
+static int buffer_write(void *user, const char *text, size_t length)
+{
+    BufferWriter *writer = user;
+    if (writer->length < writer->capacity)
+    {
+        size_t room = writer->capacity - writer->length;
+        memcpy(writer->buffer + writer->length, text, length < room ? length : room);
+    }
+    writer->length += length;
+    return 0;
+}
+
+VishellizeStatus vishellize_render_to_buffer(Vishellize *context, const void *data, size_t size,
+                                             const VishellizeOptions *options, char *buffer, size_t capacity,
+                                             size_t *length)
+{
+    BufferWriter writer = {buffer, capacity, 0};
+    VishellizeStatus status = vishellize_render(context, data, size, options, buffer_write, &writer);
+    *length = writer.length;
+    if (status == VISHELLIZE_OK && writer.length > capacity)
+        status = VISHELLIZE_TOO_SMALL;
+    return status;
+}
+
+VishellizeStatus vishellize_render_file(Vishellize *context, FILE *file, const VishellizeOptions *options, FILE *out)
+{
+    InputBuffer input;
+    if (input_open(file, &input))
+        return VISHELLIZE_FAILED;
+
+    note(context, "Input: %zu bytes (%s)\n", input.size,
+         input.mapped ? "mapped" : input.complete ? "read" : "streamed");
+
+    RenderOutput output = {.file = out};
+    VishellizeStatus status = render_input(context, &input, file, options, &output);
+
+    input_release(&input);
+    return status;
+}
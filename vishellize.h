@@ -0,0 +1,111 @@
+#ifndef VISHELLIZE_H
+#define VISHELLIZE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// libvishellize: PNG and JPEG images rendered as terminal text, for
+// programs that would otherwise run the vishellize tool once per image.
+//
+//     Vishellize *context = vishellize_create();
+//     VishellizeOptions options = {.width = 80};
+//     size_t length;
+//     if (vishellize_render_to_buffer(context, png, png_size, &options, text, sizeof(text), &length) == VISHELLIZE_OK)
+//         ...
+//     vishellize_destroy(context);
+//
+// A context keeps the JPEG decompressor from one image to the next, and
+// pixel and line buffers are recycled across the process. Contexts are
+// independent: use one per thread, all at the same time if need be.
+// Diagnostics go to stderr, as they do from the tool.
+//
+// Besides PNG and JPEG, every call takes .vzc cell grids (see vzc.h):
+// they are drawn at the size they were saved at, in the color depth and
+// sparseness asked for. Nothing is decoded or resampled, but the escapes
+// are encoded again, as they are for a live render.
+
+typedef struct Vishellize Vishellize;
+
+typedef enum {
+    VISHELLIZE_OK,
+    VISHELLIZE_UNSUPPORTED,  // Neither PNG nor JPEG
+    VISHELLIZE_FAILED,       // Corrupt image, out of memory, crop region outside the image
+    VISHELLIZE_WRITE_FAILED, // The callback or stream refused the text
+    VISHELLIZE_TOO_SMALL,    // The buffer couldn't hold all of it
+} VishellizeStatus;
+
+typedef enum {
+    VISHELLIZE_BALANCED, // Accurate decode, box filtering, truecolor
+    VISHELLIZE_FAST,     // Fast IDCT and upsampling, nearest, 256 colors
+    VISHELLIZE_BEST,     // Accurate decode everywhere, Lanczos
+} VishellizeQuality;
+
+typedef enum {
+    VISHELLIZE_PRESET_COLORS, // Whatever the quality picks
+    VISHELLIZE_TRUECOLOR,     // 24-bit SGR 38;2
+    VISHELLIZE_256_COLORS,    // xterm 256-color SGR 38;5
+} VishellizeColors;
+
+typedef enum {
+    VISHELLIZE_ONCE,        // Draw the finished image
+    VISHELLIZE_PREVIEW,     // JPEGs: a 1/8-scale preview first, then redraw what changed
+    VISHELLIZE_PROGRESSIVE, // Redraw progressive JPEGs and interlaced PNGs as they refine
+} VishellizeRefine;
+
+typedef enum {
+    VISHELLIZE_TEXT,  // Escape sequences for the terminal
+    VISHELLIZE_CELLS, // A .vzc cell grid, to be replayed later in any color mode
+} VishellizeOutput;
+
+// Source rectangle in image pixels; a zero width or height is the whole image
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} VishellizeRegion;
+
+// All zeroes is a valid start: balanced quality, as wide as the terminal
+// on stdout (or the image, if that's narrower or there's none), black
+// background, cells twice as tall as wide.
+typedef struct {
+    int width; // Output columns, 0 = fit the terminal
+    VishellizeQuality quality;
+    VishellizeColors colors;
+    int linear;                  // Downscale in linear light, keeping fine detail bright
+    unsigned char background[3]; // Transparent pixels are blended into this
+    int sparse;                  // Leave cells that look like the background to the terminal
+    int tolerance;               // How far (per channel, 0-255) from background that may be
+    int cell_width;              // Cell shape in pixels, for the aspect ratio; 0 = 1:2
+    int cell_height;
+    VishellizeRegion crop;
+    size_t max_memory; // Bytes of image buffers a decode may hold, 0 = no limit
+    VishellizeRefine refine;
+    int time_budget_ms; // Progressive: stop at the last refinement done in time, 0 = none
+    VishellizeOutput output; // Cells are written in one go, never refined
+} VishellizeOptions;
+
+// Takes each run of text as it is rendered; returns non-zero to refuse it,
+// which stops all further output of that render.
+typedef int (*VishellizeWriteFn)(void *user, const char *text, size_t length);
+
+// NULL if out of memory
+Vishellize *vishellize_create(void);
+void vishellize_destroy(Vishellize *context);
+// Progress notes (input size, refinement timings) go here; NULL = none
+void vishellize_set_log(Vishellize *context, FILE *log);
+
+// Render an image held in memory, passing the text to write
+VishellizeStatus vishellize_render(Vishellize *context, const void *data, size_t size, const VishellizeOptions *options,
+                                   VishellizeWriteFn write, void *user);
+// Render into buffer. length receives the full length of the text even
+// when it doesn't fit, so the caller can grow the buffer and try again;
+// the buffer then holds its first capacity bytes. Not NUL-terminated.
+VishellizeStatus vishellize_render_to_buffer(Vishellize *context, const void *data, size_t size,
+                                             const VishellizeOptions *options, char *buffer, size_t capacity,
+                                             size_t *length);
+// Render an image file or stream to out. Regular files are mapped; pipes
+// are decoded as they arrive wherever the format allows.
+VishellizeStatus vishellize_render_file(Vishellize *context, FILE *file, const VishellizeOptions *options, FILE *out);
+
+#endif
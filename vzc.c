@@ -0,0 +1,124 @@
+#include "vzc.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+    return p[0] | (unsigned int)p[1] << 8;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+int vzc_open(const unsigned char *data, size_t size, VzcImage *image)
+{
+    if (size < VZC_HEADER_SIZE || memcmp(data, VZC_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "Not a .vzc cell grid.\n");
+        return 1;
+    }
+
+    unsigned int version = get_u16(data + 4);
+    unsigned int header_size = get_u16(data + 6);
+    uint32_t columns = get_u32(data + 8);
+    uint32_t rows = get_u32(data + 12);
+    if (version != VZC_VERSION || data[16] != VZC_CELL_SIZE || header_size < VZC_HEADER_SIZE ||
+        header_size % VZC_CELL_SIZE != 0)
+    {
+        fprintf(stderr, "Couldn't read version %u of the .vzc format.\n", version);
+        return 1;
+    }
+
+    // Sizes are checked in 64 bits, so no header can overflow them
+    uint64_t cells_size = (uint64_t)columns * rows * VZC_CELL_SIZE;
+    if (columns == 0 || rows == 0 || columns > INT32_MAX || rows > INT32_MAX || header_size + cells_size > size)
+    {
+        fprintf(stderr, "The .vzc cell grid is truncated or corrupt.\n");
+        return 1;
+    }
+
+    image->columns = (int)columns;
+    image->rows = (int)rows;
+    memcpy(image->background, data + 17, 3);
+    image->cells = data + header_size;
+    image->size = header_size + (size_t)cells_size;
+    return 0;
+}
+
+int vzc_write(RenderOutput *out, const CellGrid *grid, const unsigned char *background)
+{
+    unsigned char *row = pool_calloc(grid->columns, VZC_CELL_SIZE);
+    if (row == NULL)
+    {
+        fprintf(stderr, "Couldn't allocate memory for cell row.\n");
+        return 1;
+    }
+
+    int previous = stats_enter(STATS_RENDER);
+    uint64_t span = trace_begin();
+
+    unsigned char header[VZC_HEADER_SIZE] = {0};
+    memcpy(header, VZC_MAGIC, 4);
+    put_u16(header + 4, VZC_VERSION);
+    put_u16(header + 6, VZC_HEADER_SIZE);
+    put_u32(header + 8, (uint32_t)grid->columns);
+    put_u32(header + 12, (uint32_t)grid->rows);
+    header[16] = VZC_CELL_SIZE;
+    memcpy(header + 17, background, 3);
+    render_output_write(out, (const char *)header, sizeof(header));
+
+    // Only the foreground changes from cell to cell
+    for (int y = 0; y < grid->rows; y++)
+    {
+        const unsigned char *rgb = grid->rgb + (size_t)y * grid->columns * 3;
+        for (int x = 0; x < grid->columns; x++)
+            memcpy(row + x * VZC_CELL_SIZE + 1, rgb + x * 3, 3);
+        render_output_write(out, (const char *)row, (size_t)grid->columns * VZC_CELL_SIZE);
+    }
+
+    trace_end("serialize cells", span);
+    stats_leave(previous);
+    pool_free(row);
+    return 0;
+}
+
+int vzc_render(const VzcImage *image, const RenderOptions *options, RenderOutput *out)
+{
+    Renderer renderer;
+    if (renderer_init(&renderer, out, image->columns, options))
+    {
+        fprintf(stderr, "Couldn't allocate memory for output line.\n");
+        return 1;
+    }
+
+    int previous = stats_enter(STATS_RENDER);
+    uint64_t span = trace_begin();
+
+    // Rows are drawn straight from the cells: the foreground sits at the
+    // start of each, so the cell size serves as the pixel stride
+    size_t row_size = (size_t)image->columns * VZC_CELL_SIZE;
+    for (int y = 0; y < image->rows; y++)
+        render_row(&renderer, image->cells + y * row_size + 1, image->columns, VZC_CELL_SIZE);
+
+    trace_end("replay cells", span);
+    stats_leave(previous);
+    renderer_free(&renderer);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef VZC_H
+#define VZC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "render.h"
+
+// .vzc: a rendered cell grid kept apart from any one escape encoding, so
+// it can be replayed as truecolor, 256 colors or sparse output without
+// decoding the image again. Little-endian, and laid out to be mapped and
+// used in place:
+//
+//     offset  size
+//     0       4     magic "VZC\x1a"
+//     4       2     version (1)
+//     6       2     header size: the cells start here, on an 8-byte boundary
+//     8       4     columns
+//     12      4     rows
+//     16      1     cell size (8)
+//     17      3     background transparent pixels were blended into, RGB
+//     20      4     zero
+//
+// Then columns * rows cells, row by row:
+//
+//     0       1     glyph: VZC_GLYPH_FULL_BLOCK, the only one drawn so far
+//     1       3     foreground RGB
+//     4       3     background RGB, unused by full blocks (zero)
+//     7       1     zero
+
+#define VZC_MAGIC "VZC\x1a"
+#define VZC_VERSION 1
+#define VZC_HEADER_SIZE 24
+#define VZC_CELL_SIZE 8
+
+#define VZC_GLYPH_FULL_BLOCK 0 // U+2588, colored by the foreground
+
+typedef struct {
+    int columns;
+    int rows;
+    unsigned char background[3];
+    const unsigned char *cells; // Inside the data given to vzc_open()
+    size_t size;                // Bytes of header and cells
+} VzcImage;
+
+// Checks the header and that every cell is there. Returns non-zero if
+// data isn't a .vzc this version can read.
+int vzc_open(const unsigned char *data, size_t size, VzcImage *image);
+// Serialize a captured grid. Returns non-zero if out of memory.
+int vzc_write(RenderOutput *out, const CellGrid *grid, const unsigned char *background);
+// Draw the cells as text, in the color depth and sparseness of options.
+// The grid keeps the size it was saved at. Nothing is decoded, but every
+// row goes through render_row() again, so this costs a live render's
+// escape encoding.
+int vzc_render(const VzcImage *image, const RenderOptions *options, RenderOutput *out);
+
+#endif